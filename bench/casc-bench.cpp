@@ -0,0 +1,325 @@
+/*****************************************************************************/
+/* casc-bench.cpp                            Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* time opening, enumerating, searching and reading a CASC storage           */
+/*****************************************************************************/
+
+#include "../CascLib/src/CascLib.h"
+#include "../include/SimpleOpt.h"
+#include "filter.h"
+#include "md5.h"
+#include "memextract.h"
+#include "stats.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// All the global variables
+string strSource = "synthetic-storage";
+tSearchFilter searchFilter;
+int nIterations = 3;
+string strExpected;
+
+enum {
+    OPT_HELP,
+    OPT_SRC,
+    OPT_ITERATIONS,
+    OPT_SEARCH,
+    OPT_FILEEXT,
+    OPT_EXPECT
+};
+
+const CSimpleOpt::SOption COMMAND_LINE_OPTIONS[] = {
+    { OPT_HELP,             "-h",               SO_NONE    },
+    { OPT_HELP,             "--help",           SO_NONE    },
+    { OPT_SRC,              "-i",               SO_REQ_SEP },
+    { OPT_SRC,              "--in",             SO_REQ_SEP },
+    { OPT_ITERATIONS,       "-n",               SO_REQ_SEP },
+    { OPT_ITERATIONS,       "--iterations",     SO_REQ_SEP },
+    { OPT_SEARCH,           "-s",               SO_REQ_SEP },
+    { OPT_SEARCH,           "--search",         SO_REQ_SEP },
+    { OPT_FILEEXT,          "-t",               SO_REQ_SEP },
+    { OPT_FILEEXT,          "--filetype",       SO_REQ_SEP },
+    { OPT_EXPECT,           "--expect",         SO_REQ_SEP },
+
+    SO_END_OF_OPTIONS
+};
+
+/* FUNCTIONS */
+void showUsage(const std::string &pathToExecutable) {
+    cout << "Usage: " << pathToExecutable << " [options]" << endl
+         << endl
+         << "Times each step of reading a CASC storage, best of several runs." << endl
+         << endl
+         << "    -i, --in <PATH>           Game directory (default: 'synthetic-storage')" << endl
+         << "    -n, --iterations <N>      Runs of each step (default: 3)" << endl
+         << "    -s, --search <STRING>     Full paths the search and read steps keep (default: all)" << endl
+         << "    -t, --filetype <STRING>   Extension the search and read steps keep" << endl
+         << "        --expect <FILE>       First check that the storage lists and reads back exactly" << endl
+         << "                                the files of FILE (casc-generate --manifest), and fail" << endl
+         << "                                if it does not" << endl;
+}
+
+// One measured step: the best time over all iterations, and what it did
+struct tResult {
+    const char *szName;
+    double best;
+    unsigned long long items;
+    unsigned long long bytes;
+};
+
+void report(const tResult &result) {
+    printf("  %-10s %10.3f ms %12llu items %12.0f items/s", result.szName, result.best * 1e3,
+           result.items, result.best > 0 ? result.items / result.best : 0.0);
+    if (result.bytes)
+        printf(" %10.1f MB/s", result.best > 0 ? result.bytes / 1048576.0 / result.best : 0.0);
+    printf("\n");
+}
+
+size_t enumerate(HANDLE hStorage, const tSearchFilter *filter, vector<string> *matches) {
+    CASC_FIND_DATA findData;
+    size_t count = 0;
+    HANDLE handle = CascFindFirstFile(hStorage, "*", &findData, NULL);
+    if (!handle)
+        return 0;
+
+    do {
+        if (filter) {
+            size_t nFullPath = strlen(findData.szFileName);
+            size_t nPlainName = nFullPath - size_t(findData.szPlainName - findData.szFileName);
+            if (!filter->matches(findData.szFileName, nFullPath, findData.szPlainName, nPlainName, findData.dwFileSize))
+                continue;
+            if (matches)
+                matches->push_back(findData.szFileName);
+        }
+        count++;
+    } while (CascFindNextFile(handle, &findData) && findData.szPlainName);
+
+    CascFindClose(handle);
+    return count;
+}
+
+// Lowercase with '/' separators, how CascLib may hand back a generated path
+string normalizePath(const char *szPath) {
+    string ret(szPath);
+    for (size_t i = 0; i < ret.size(); ++i)
+        ret[i] = (ret[i] == '\\') ? '/' : char(tolower((unsigned char) ret[i]));
+    return ret;
+}
+
+string toHex(const unsigned char *data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    string ret;
+    for (size_t i = 0; i < size; ++i) {
+        ret += digits[data[i] >> 4];
+        ret += digits[data[i] & 0xF];
+    }
+    return ret;
+}
+
+/* Timings of a storage CascLib misreads mean nothing, and casc-generate
+ * writes the format by hand.  So the whole round trip is checked first:
+ * CascOpenStorage(), then every name CascFindFirstFile() lists must be in
+ * the manifest with the same size, and CascReadFile() must return exactly
+ * that many bytes with the same MD5.  Files the manifest has but the
+ * storage does not list fail too.
+ *
+ * @return How many files were wrong, each one is printed
+ */
+size_t checkStorage(const char *szExpected) {
+    struct tExpected {
+        unsigned long long size;
+        string strDigest;
+        bool bSeen;
+    };
+
+    map<string, tExpected> expected;
+    ifstream in(szExpected);
+    if (!in) {
+        cerr << "Failed to read the manifest '" << szExpected << "'" << endl;
+        return 1;
+    }
+    string strLine;
+    while (getline(in, strLine)) {
+        size_t tab1 = strLine.find('\t'), tab2 = strLine.rfind('\t');
+        if (tab1 == string::npos || tab1 == tab2) {
+            cerr << "Invalid line in the manifest '" << szExpected << "': " << strLine << endl;
+            return 1;
+        }
+        tExpected entry = { strtoull(strLine.c_str() + tab1 + 1, NULL, 10), strLine.substr(tab2 + 1), false };
+        expected[normalizePath(strLine.substr(0, tab1).c_str())] = entry;
+    }
+
+    HANDLE hStorage;
+    if (!CascOpenStorage(strSource.c_str(), 0, &hStorage)) {
+        cerr << "Failed to open the storage '" << strSource << "'" << endl;
+        return 1;
+    }
+
+    vector<string> names;
+    vector<unsigned long long> sizes;
+    CASC_FIND_DATA findData;
+    HANDLE handle = CascFindFirstFile(hStorage, "*", &findData, NULL);
+    if (handle) {
+        do {
+            names.push_back(findData.szFileName);
+            sizes.push_back(findData.dwFileSize);
+        } while (CascFindNextFile(handle, &findData) && findData.szPlainName);
+        CascFindClose(handle);
+    }
+
+    size_t problems = 0;
+    auto problem = [&](const string &strMessage) {
+        if (++problems <= 20)
+            cerr << strMessage << endl;
+    };
+
+    tMemoryExtractor extractor(hStorage);
+    for (size_t i = 0; i < names.size(); ++i) {
+        map<string, tExpected>::iterator iter = expected.find(normalizePath(names[i].c_str()));
+        if (iter == expected.end()) {
+            problem("UNEXPECTED: '" + names[i] + "' is not in the manifest");
+            continue;
+        }
+        tExpected &entry = iter->second;
+        entry.bSeen = true;
+
+        tMD5 md5;
+        unsigned long long bytes = 0;
+        bool bRead = extractor.extract(names[i].c_str(), [&](const tChunk &chunk) {
+            md5.update(chunk.data, chunk.size);
+            bytes += chunk.size;
+            return true;
+        });
+        unsigned char digest[MD5_DIGEST_SIZE];
+        md5.final(digest);
+
+        if (!bRead)
+            problem("NOREAD: '" + names[i] + "' could not be read");
+        else if (sizes[i] != entry.size || bytes != entry.size)
+            problem("SIZE: '" + names[i] + "' is listed with " + to_string(sizes[i]) + " bytes and reads " +
+                    to_string(bytes) + ", expected " + to_string(entry.size));
+        else if (toHex(digest, MD5_DIGEST_SIZE) != entry.strDigest)
+            problem("MD5: '" + names[i] + "' reads back as " + toHex(digest, MD5_DIGEST_SIZE) + ", expected " +
+                    entry.strDigest);
+    }
+
+    for (map<string, tExpected>::const_iterator iter = expected.begin(); iter != expected.end(); ++iter) {
+        if (!iter->second.bSeen)
+            problem("MISSING: '" + iter->first + "' is not listed by the storage");
+    }
+
+    CascCloseStorage(hStorage);
+
+    printf("round trip: %zu files listed, %zu expected, %zu wrong\n", names.size(), expected.size(), problems);
+    return problems;
+}
+
+/** main()
+ */
+
+int main(int argc, char** argv) {
+    CSimpleOpt args(argc, argv, COMMAND_LINE_OPTIONS);
+    while (args.Next())
+    {
+        if (args.LastError() != SO_SUCCESS)
+        {
+            cerr << "Invalid argument: " << args.OptionText() << endl;
+            return -1;
+        }
+
+        switch (args.OptionId())
+        {
+            case OPT_HELP:
+                showUsage(argv[0]);
+                return 0;
+
+            case OPT_SRC:
+                strSource = args.OptionArg();
+                break;
+
+            case OPT_ITERATIONS:
+                nIterations = max(1, atoi(args.OptionArg()));
+                break;
+
+            case OPT_SEARCH:
+                searchFilter.strSearchPattern = args.OptionArg();
+                break;
+
+            case OPT_FILEEXT:
+                searchFilter.bFileExt = true;
+                searchFilter.strFileExt = args.OptionArg();
+                break;
+
+            case OPT_EXPECT:
+                strExpected = args.OptionArg();
+                break;
+        }
+    }
+
+    if (!strExpected.empty() && checkStorage(strExpected.c_str()) != 0) {
+        cerr << "The storage does not read back as '" << strExpected << "', see above" << endl;
+        return -3;
+    }
+
+    tResult open = { "open", 1e30, 1, 0 };
+    tResult enumeration = { "enumerate", 1e30, 0, 0 };
+    tResult search = { "search", 1e30, 0, 0 };
+    tResult read = { "read", 1e30, 0, 0 };
+
+    for (int iteration = 0; iteration < nIterations; ++iteration) {
+        HANDLE hStorage;
+        double start = tStats::wallClock();
+        if (!CascOpenStorage(strSource.c_str(), 0, &hStorage)) {
+            cerr << "Failed to open the storage '" << strSource << "'" << endl;
+            return -2;
+        }
+        open.best = min(open.best, tStats::wallClock() - start);
+
+        start = tStats::wallClock();
+        enumeration.items = enumerate(hStorage, NULL, NULL);
+        enumeration.best = min(enumeration.best, tStats::wallClock() - start);
+
+        vector<string> matches;
+        start = tStats::wallClock();
+        enumerate(hStorage, &searchFilter, &matches);
+        search.best = min(search.best, tStats::wallClock() - start);
+        search.items = enumeration.items;
+
+        // Read every match to memory, so only CascLib is measured
+        unsigned long long bytes = 0;
+        start = tStats::wallClock();
+        tMemoryExtractor extractor(hStorage);
+        for (size_t i = 0; i < matches.size(); ++i) {
+            bool bRead = extractor.extract(matches[i].c_str(), [&](const tChunk &chunk) {
+                bytes += chunk.size;
+                return true;
+            });
+            if (!bRead)
+                cerr << "Failed to read '" << matches[i] << "'" << endl;
+        }
+        read.best = min(read.best, tStats::wallClock() - start);
+        read.items = matches.size();
+        read.bytes = bytes;
+
+        CascCloseStorage(hStorage);
+    }
+
+    printf("storage '%s', best of %d:\n", strSource.c_str(), nIterations);
+    report(open);
+    report(enumeration);
+    report(search);
+    report(read);
+    return 0;
+}
@@ -0,0 +1,693 @@
+/*****************************************************************************/
+/* casc-generate.cpp                         Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* write a synthetic CASC storage, for benchmarks that need no game install  */
+/*****************************************************************************/
+
+#include "../include/SimpleOpt.h"
+#include "manifest.h"
+#include "md5.h"
+
+#include <zlib.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* The storage is laid out the way CascLib reads an installed game:
+ *
+ *   <out>/.build.info                      points to the build and CDN configs
+ *   <out>/HeroesData/config/xx/yy/<key>    the configs, named by their MD5
+ *   <out>/HeroesData/data/data.NNN         BLTE encoded files, each behind a
+ *                                          30 byte record header
+ *   <out>/HeroesData/data/XXVVVVVVVV.idx   encoding key -> archive, offset, size
+ *
+ * The ENCODING file maps content keys to encoding keys.  The root file is the
+ * plain-text kind ("#MD5|CHUNK_ID|FILENAME|INSTALLPATH"), which names every
+ * file without needing a listfile.
+ */
+
+typedef vector<unsigned char> tBytes;
+
+// All the global variables
+string strOutput = "synthetic-storage";
+size_t nFiles = 10000;
+unsigned long long nMinSize = 1;
+unsigned long long nMaxSize = 1 << 20;
+int nDepth = 4;
+int nFanout = 8;
+bool bCompress = true;
+size_t nChunkSize = 0x10000;
+unsigned int nSeed = 1;
+bool bQuiet = false;
+string strManifest;
+
+static const uint64_t ARCHIVE_LIMIT = 0x40000000;   // 30 offset bits per data.NNN
+static const size_t RECORD_HEADER_SIZE = 0x1E;
+static const size_t ENCODING_PAGE_SIZE = 0x1000;
+
+enum {
+    OPT_HELP,
+    OPT_QUIET,
+    OPT_OUTPUT,
+    OPT_FILES,
+    OPT_MINSIZE,
+    OPT_MAXSIZE,
+    OPT_DEPTH,
+    OPT_FANOUT,
+    OPT_COMPRESS,
+    OPT_CHUNKSIZE,
+    OPT_SEED,
+    OPT_MANIFEST
+};
+
+const CSimpleOpt::SOption COMMAND_LINE_OPTIONS[] = {
+    { OPT_HELP,             "-h",               SO_NONE    },
+    { OPT_HELP,             "--help",           SO_NONE    },
+    { OPT_QUIET,            "-q",               SO_NONE    },
+    { OPT_QUIET,            "--quiet",          SO_NONE    },
+    { OPT_OUTPUT,           "-o",               SO_REQ_SEP },
+    { OPT_OUTPUT,           "--out",            SO_REQ_SEP },
+    { OPT_FILES,            "--files",          SO_REQ_SEP },
+    { OPT_MINSIZE,          "--min-size",       SO_REQ_SEP },
+    { OPT_MAXSIZE,          "--max-size",       SO_REQ_SEP },
+    { OPT_DEPTH,            "--depth",          SO_REQ_SEP },
+    { OPT_FANOUT,           "--fanout",         SO_REQ_SEP },
+    { OPT_COMPRESS,         "--compress",       SO_REQ_SEP },
+    { OPT_CHUNKSIZE,        "--chunk-size",     SO_REQ_SEP },
+    { OPT_SEED,             "--seed",           SO_REQ_SEP },
+    { OPT_MANIFEST,         "--manifest",       SO_REQ_SEP },
+
+    SO_END_OF_OPTIONS
+};
+
+/* FUNCTIONS */
+void showUsage(const std::string &pathToExecutable) {
+    cout << "Usage: " << pathToExecutable << " [options]" << endl
+         << endl
+         << "Writes a synthetic CASC storage that storm-extract and the benchmarks can open." << endl
+         << endl
+         << "    -o, --out <PATH>          Game directory to create (default: 'synthetic-storage')" << endl
+         << "        --files <N>           Number of files (default: 10000)" << endl
+         << "        --min-size <BYTES>    Smallest file (default: 1)" << endl
+         << "        --max-size <BYTES>    Largest file (default: 1048576), sizes are spread" << endl
+         << "                                evenly on a log scale in between" << endl
+         << "        --depth <N>           Deepest directory level (default: 4)" << endl
+         << "        --fanout <N>          Subdirectories per directory (default: 8)" << endl
+         << "        --compress <zlib|none> BLTE frame encoding (default: zlib)" << endl
+         << "        --chunk-size <BYTES>  Largest BLTE frame (default: 65536)" << endl
+         << "        --seed <N>            Seed for names, sizes and contents (default: 1)" << endl
+         << "        --manifest <FILE>     Write the path, size and MD5 of every file to FILE, in" << endl
+         << "                                storm-extract's --manifest format (casc-bench --expect)" << endl
+         << "    -q, --quiet               Prints nothing" << endl;
+}
+
+/* Bob Jenkins' lookup3 hashlittle2(), which CASC uses to check index files
+ * and record headers.  Byte-wise, so it does not care about alignment.
+ */
+void hashLittle2(const void *key, size_t length, uint32_t *pc, uint32_t *pb) {
+    #define ROT(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
+    const unsigned char *k = (const unsigned char *) key;
+    uint32_t a, b, c;
+    a = b = c = 0xdeadbeef + uint32_t(length) + *pc;
+    c += *pb;
+
+    while (length > 12) {
+        a += k[0] + (uint32_t(k[1]) << 8) + (uint32_t(k[2]) << 16) + (uint32_t(k[3]) << 24);
+        b += k[4] + (uint32_t(k[5]) << 8) + (uint32_t(k[6]) << 16) + (uint32_t(k[7]) << 24);
+        c += k[8] + (uint32_t(k[9]) << 8) + (uint32_t(k[10]) << 16) + (uint32_t(k[11]) << 24);
+        a -= c; a ^= ROT(c, 4);  c += b;
+        b -= a; b ^= ROT(a, 6);  a += c;
+        c -= b; c ^= ROT(b, 8);  b += a;
+        a -= c; a ^= ROT(c, 16); c += b;
+        b -= a; b ^= ROT(a, 19); a += c;
+        c -= b; c ^= ROT(b, 4);  b += a;
+        length -= 12;
+        k += 12;
+    }
+
+    switch (length) {
+        case 12: c += uint32_t(k[11]) << 24; // fall through
+        case 11: c += uint32_t(k[10]) << 16; // fall through
+        case 10: c += uint32_t(k[9]) << 8;   // fall through
+        case 9:  c += k[8];                  // fall through
+        case 8:  b += uint32_t(k[7]) << 24;  // fall through
+        case 7:  b += uint32_t(k[6]) << 16;  // fall through
+        case 6:  b += uint32_t(k[5]) << 8;   // fall through
+        case 5:  b += k[4];                  // fall through
+        case 4:  a += uint32_t(k[3]) << 24;  // fall through
+        case 3:  a += uint32_t(k[2]) << 16;  // fall through
+        case 2:  a += uint32_t(k[1]) << 8;   // fall through
+        case 1:  a += k[0];
+            break;
+        case 0:
+            *pc = c;
+            *pb = b;
+            return;
+    }
+
+    c ^= b; c -= ROT(b, 14);
+    a ^= c; a -= ROT(c, 11);
+    b ^= a; b -= ROT(a, 25);
+    c ^= b; c -= ROT(b, 16);
+    a ^= c; a -= ROT(c, 4);
+    b ^= a; b -= ROT(a, 14);
+    c ^= b; c -= ROT(b, 24);
+    *pc = c;
+    *pb = b;
+    #undef ROT
+}
+
+uint32_t hashLittle(const void *key, size_t length, uint32_t initval) {
+    uint32_t c = initval, b = 0;
+    hashLittle2(key, length, &c, &b);
+    return c;
+}
+
+void putBE(tBytes &out, uint64_t value, int size) {
+    for (int i = size - 1; i >= 0; --i)
+        out.push_back((unsigned char) (value >> (8 * i)));
+}
+
+void putLE(tBytes &out, uint64_t value, int size) {
+    for (int i = 0; i < size; ++i)
+        out.push_back((unsigned char) (value >> (8 * i)));
+}
+
+string toHex(const unsigned char *data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    string ret;
+    for (size_t i = 0; i < size; ++i) {
+        ret += digits[data[i] >> 4];
+        ret += digits[data[i] & 15];
+    }
+    return ret;
+}
+
+bool makeDirectory(const string &strPath) {
+    return mkdir(strPath.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+bool writeFile(const string &strPath, const void *data, size_t size) {
+    FILE *file = fopen(strPath.c_str(), "wb");
+    if (!file)
+        return false;
+    bool bWritten = fwrite(data, 1, size, file) == size;
+    return (fclose(file) == 0) && bWritten;
+}
+
+// xorshift64*, fast and the same on every platform for a given seed
+struct tRandom {
+    uint64_t state;
+
+    explicit tRandom(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {
+    }
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // Uniform in [0, 1)
+    double real() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+/* Encode a file as BLTE, one frame per chunk.
+ *
+ * @param encoded   Receives the BLTE data, starting with the signature
+ * @param ekey      Receives the encoding key, the MD5 of the BLTE header
+ */
+void encodeBlte(const unsigned char *data, size_t size, bool bZlib, tBytes &encoded, unsigned char ekey[MD5_DIGEST_SIZE]) {
+    size_t nChunks = size ? (size + nChunkSize - 1) / nChunkSize : 1;
+    vector<tBytes> frames(nChunks);
+
+    for (size_t i = 0; i < nChunks; ++i) {
+        const unsigned char *chunk = data + i * nChunkSize;
+        size_t chunkSize = min(nChunkSize, size - i * nChunkSize);
+        tBytes &frame = frames[i];
+
+        if (bZlib && chunkSize > 0) {
+            uLongf nCompressed = compressBound(uLong(chunkSize));
+            frame.resize(1 + nCompressed);
+            frame[0] = 'Z';
+            if (compress2(&frame[1], &nCompressed, chunk, uLong(chunkSize), 6) == Z_OK && nCompressed < chunkSize) {
+                frame.resize(1 + nCompressed);
+                continue;
+            }
+        }
+        frame.assign(1, 'N');
+        frame.insert(frame.end(), chunk, chunk + chunkSize);
+    }
+
+    encoded.clear();
+    encoded.push_back('B');
+    encoded.push_back('L');
+    encoded.push_back('T');
+    encoded.push_back('E');
+    putBE(encoded, 12 + 24 * nChunks, 4);
+    encoded.push_back(0x0F);
+    putBE(encoded, nChunks, 3);
+    for (size_t i = 0; i < nChunks; ++i) {
+        unsigned char hash[MD5_DIGEST_SIZE];
+        tMD5::hash(frames[i].data(), frames[i].size(), hash);
+        putBE(encoded, frames[i].size(), 4);
+        putBE(encoded, min(nChunkSize, size - i * nChunkSize), 4);
+        encoded.insert(encoded.end(), hash, hash + MD5_DIGEST_SIZE);
+    }
+    tMD5::hash(encoded.data(), encoded.size(), ekey);
+
+    for (size_t i = 0; i < nChunks; ++i)
+        encoded.insert(encoded.end(), frames[i].begin(), frames[i].end());
+}
+
+// What the ENCODING file and the index files need to know about a file
+struct tStoredFile {
+    unsigned char ckey[MD5_DIGEST_SIZE];
+    unsigned char ekey[MD5_DIGEST_SIZE];
+    uint64_t contentSize;
+    uint64_t encodedSize;               // BLTE data, without the record header
+    uint32_t archiveIndex;
+    uint64_t archiveOffset;             // Of the record header
+    bool bZlib;
+};
+
+/* Appends records to data.000, data.001, ... and remembers where each went.
+ */
+class tArchiveWriter {
+public:
+    vector<tStoredFile> files;
+
+    tArchiveWriter() : archive(NULL), archiveIndex(0), archiveOffset(0) {
+    }
+
+    ~tArchiveWriter() {
+        close();
+    }
+
+    bool close() {
+        bool bClosed = true;
+        if (archive)
+            bClosed = (fclose(archive) == 0);
+        archive = NULL;
+        return bClosed;
+    }
+
+    /* Store one file.  Identical contents are stored once, like in a game.
+     *
+     * @return false if the archive could not be written
+     */
+    bool store(const unsigned char *data, size_t size, bool bZlib, tStoredFile &stored) {
+        tMD5::hash(data, size, stored.ckey);
+        string strKey((const char *) stored.ckey, MD5_DIGEST_SIZE);
+        map<string, size_t>::const_iterator known = knownContent.find(strKey);
+        if (known != knownContent.end()) {
+            stored = files[known->second];
+            return true;
+        }
+        knownContent[strKey] = files.size();
+
+        encodeBlte(data, size, bZlib, encoded, stored.ekey);
+        stored.contentSize = size;
+        stored.encodedSize = encoded.size();
+        stored.bZlib = bZlib;
+
+        uint64_t recordSize = RECORD_HEADER_SIZE + encoded.size();
+        if (!archive || archiveOffset + recordSize > ARCHIVE_LIMIT) {
+            if (archive) {
+                if (!close())
+                    return false;
+                archiveIndex++;
+            }
+            char szName[16];
+            snprintf(szName, sizeof(szName), "data.%03u", archiveIndex);
+            archive = fopen((strOutput + "/HeroesData/data/" + szName).c_str(), "wb");
+            archiveOffset = 0;
+            if (!archive)
+                return false;
+        }
+        stored.archiveIndex = archiveIndex;
+        stored.archiveOffset = archiveOffset;
+
+        // Record header: encoding key reversed, size of the whole record, two
+        // flag bytes, and a Jenkins hash of those fields.  The second checksum
+        // is left at zero.
+        tBytes header;
+        for (int i = MD5_DIGEST_SIZE - 1; i >= 0; --i)
+            header.push_back(stored.ekey[i]);
+        putLE(header, recordSize, 4);
+        header.push_back(0);
+        header.push_back(0);
+        putLE(header, hashLittle(header.data(), header.size(), 0x3D6BE971), 4);
+        putLE(header, 0, 4);
+
+        if (fwrite(header.data(), 1, header.size(), archive) != header.size() ||
+            fwrite(encoded.data(), 1, encoded.size(), archive) != encoded.size())
+            return false;
+        archiveOffset += recordSize;
+
+        files.push_back(stored);
+        return true;
+    }
+
+private:
+    FILE *archive;
+    uint32_t archiveIndex;
+    uint64_t archiveOffset;
+    tBytes encoded;
+    map<string, size_t> knownContent;        // Content key -> index in files
+};
+
+bool compareByCKey(const tStoredFile &a, const tStoredFile &b) {
+    return memcmp(a.ckey, b.ckey, MD5_DIGEST_SIZE) < 0;
+}
+
+bool compareByEKey(const tStoredFile &a, const tStoredFile &b) {
+    return memcmp(a.ekey, b.ekey, MD5_DIGEST_SIZE) < 0;
+}
+
+/* Lay entries out in fixed-size pages, an entry never straddling two, and
+ * prefix the pages with an index of their first key and MD5.
+ */
+template <typename Put>
+void writePages(tBytes &index, tBytes &pages, const vector<tStoredFile> &files, size_t entrySize,
+                const unsigned char *(*firstKey)(const tStoredFile &), Put put) {
+    size_t perPage = ENCODING_PAGE_SIZE / entrySize;
+    for (size_t first = 0; first < files.size(); first += perPage) {
+        size_t start = pages.size();
+        for (size_t i = first; i < files.size() && i < first + perPage; ++i)
+            put(pages, files[i]);
+        pages.resize(start + ENCODING_PAGE_SIZE, 0);
+
+        unsigned char hash[MD5_DIGEST_SIZE];
+        tMD5::hash(&pages[start], ENCODING_PAGE_SIZE, hash);
+        const unsigned char *key = firstKey(files[first]);
+        index.insert(index.end(), key, key + MD5_DIGEST_SIZE);
+        index.insert(index.end(), hash, hash + MD5_DIGEST_SIZE);
+    }
+}
+
+const unsigned char *getCKey(const tStoredFile &file) {
+    return file.ckey;
+}
+
+const unsigned char *getEKey(const tStoredFile &file) {
+    return file.ekey;
+}
+
+/* Build the ENCODING file for every stored file.
+ *
+ * Content key pages hold (key count, content size, content key, encoding
+ * key) and encoding key pages hold (encoding key, spec index, encoded size).
+ */
+tBytes buildEncoding(vector<tStoredFile> files) {
+    static const char especs[] = "n\0z";     // Index 0: raw frames, 1: zlib
+
+    tBytes ckeyIndex, ckeyPages, ekeyIndex, ekeyPages;
+    sort(files.begin(), files.end(), compareByCKey);
+    writePages(ckeyIndex, ckeyPages, files, 6 + 2 * MD5_DIGEST_SIZE, getCKey, [](tBytes &out, const tStoredFile &file) {
+        out.push_back(1);
+        putBE(out, file.contentSize, 5);
+        out.insert(out.end(), file.ckey, file.ckey + MD5_DIGEST_SIZE);
+        out.insert(out.end(), file.ekey, file.ekey + MD5_DIGEST_SIZE);
+    });
+
+    sort(files.begin(), files.end(), compareByEKey);
+    writePages(ekeyIndex, ekeyPages, files, MD5_DIGEST_SIZE + 9, getEKey, [](tBytes &out, const tStoredFile &file) {
+        out.insert(out.end(), file.ekey, file.ekey + MD5_DIGEST_SIZE);
+        putBE(out, file.bZlib ? 1 : 0, 4);
+        putBE(out, file.encodedSize, 5);
+    });
+
+    tBytes encoding;
+    encoding.push_back('E');
+    encoding.push_back('N');
+    encoding.push_back(1);
+    encoding.push_back(MD5_DIGEST_SIZE);
+    encoding.push_back(MD5_DIGEST_SIZE);
+    putBE(encoding, ENCODING_PAGE_SIZE / 1024, 2);
+    putBE(encoding, ENCODING_PAGE_SIZE / 1024, 2);
+    putBE(encoding, ckeyIndex.size() / (2 * MD5_DIGEST_SIZE), 4);
+    putBE(encoding, ekeyIndex.size() / (2 * MD5_DIGEST_SIZE), 4);
+    encoding.push_back(0);
+    putBE(encoding, sizeof(especs), 4);
+    encoding.insert(encoding.end(), especs, especs + sizeof(especs));
+    encoding.insert(encoding.end(), ckeyIndex.begin(), ckeyIndex.end());
+    encoding.insert(encoding.end(), ckeyPages.begin(), ckeyPages.end());
+    encoding.insert(encoding.end(), ekeyIndex.begin(), ekeyIndex.end());
+    encoding.insert(encoding.end(), ekeyPages.begin(), ekeyPages.end());
+    return encoding;
+}
+
+/* Write the sixteen index files, version 2 (".idx" with 9 byte keys).
+ *
+ * Each stored file goes to the bucket its encoding key hashes to.
+ */
+bool writeIndexFiles(const vector<tStoredFile> &files) {
+    vector<vector<const tStoredFile *> > buckets(16);
+    for (size_t i = 0; i < files.size(); ++i) {
+        unsigned char x = 0;
+        for (int j = 0; j < 9; ++j)
+            x ^= files[i].ekey[j];
+        buckets[(x & 0x0F) ^ (x >> 4)].push_back(&files[i]);
+    }
+
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        vector<const tStoredFile *> &entries = buckets[bucket];
+        sort(entries.begin(), entries.end(), [](const tStoredFile *a, const tStoredFile *b) {
+            return memcmp(a->ekey, b->ekey, 9) < 0;
+        });
+
+        tBytes header;
+        putLE(header, 7, 2);                // Version
+        header.push_back((unsigned char) bucket);
+        header.push_back(0);                // Extra bytes
+        header.push_back(4);                // Bytes of the size field
+        header.push_back(5);                // Bytes of the offset field
+        header.push_back(9);                // Bytes of the key
+        header.push_back(30);               // Offset bits, the rest is the archive index
+        putLE(header, 0x4000000000ULL, 8);  // Largest offset the game allows
+
+        tBytes data;
+        putLE(data, header.size(), 4);
+        putLE(data, hashLittle(header.data(), header.size(), 0), 4);
+        data.insert(data.end(), header.begin(), header.end());
+        data.resize((data.size() + 0x0F) & ~size_t(0x0F), 0);
+
+        tBytes block;
+        uint32_t pc = 0, pb = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            size_t start = block.size();
+            block.insert(block.end(), entries[i]->ekey, entries[i]->ekey + 9);
+            putBE(block, (uint64_t(entries[i]->archiveIndex) << 30) | entries[i]->archiveOffset, 5);
+            putLE(block, RECORD_HEADER_SIZE + entries[i]->encodedSize, 4);
+            hashLittle2(&block[start], block.size() - start, &pc, &pb);
+        }
+        putLE(data, block.size(), 4);
+        putLE(data, pc, 4);
+        data.insert(data.end(), block.begin(), block.end());
+        data.resize((data.size() + 0xFFFF) & ~size_t(0xFFFF), 0);
+
+        char szName[32];
+        snprintf(szName, sizeof(szName), "%02x%08x.idx", unsigned(bucket), 1u);
+        if (!writeFile(strOutput + "/HeroesData/data/" + szName, data.data(), data.size()))
+            return false;
+    }
+    return true;
+}
+
+// Configs are stored as config/xx/yy/<md5 of the text>
+bool writeConfig(const string &strText, unsigned char key[MD5_DIGEST_SIZE]) {
+    tMD5::hash(strText.data(), strText.size(), key);
+    string strKey = toHex(key, MD5_DIGEST_SIZE);
+    string strPath = strOutput + "/HeroesData/config/" + strKey.substr(0, 2);
+    if (!makeDirectory(strPath))
+        return false;
+    strPath += "/" + strKey.substr(2, 2);
+    if (!makeDirectory(strPath))
+        return false;
+    return writeFile(strPath + "/" + strKey, strText.data(), strText.size());
+}
+
+/* Fill a buffer with text-like bytes: words from a small vocabulary, so
+ * zlib gets the kind of ratio it gets on game data rather than none at all.
+ */
+void fillContent(tRandom &random, unsigned char *data, size_t size) {
+    static const char *words[] = {
+        "Actor", "Unit", "Model", "Sound", "Effect", "Behavior", "Ability", "Weapon", "Hero", "Talent",
+        "<CUnit id=\"", "\"/>\n", "Value=\"", "Flags", "0", "1", "255", "Footprint", "Mover", "Button"
+    };
+    size_t i = 0;
+    while (i < size) {
+        uint64_t r = random.next();
+        if ((r & 7) == 0) {
+            data[i++] = (unsigned char) (r >> 8);
+            continue;
+        }
+        const char *word = words[(r >> 3) % (sizeof(words) / sizeof(words[0]))];
+        for (; *word && i < size; ++word)
+            data[i++] = (unsigned char) *word;
+    }
+}
+
+// A path a few directories deep, with the extensions the game uses
+string makePath(tRandom &random, size_t index) {
+    static const char *extensions[] = { "xml", "dds", "ogg", "m3", "txt", "wav", "galaxy", "m3a" };
+    string strPath = "mods";
+    int depth = 1 + int(random.next() % nDepth);
+    for (int level = 0; level < depth; ++level) {
+        char szDir[24];
+        snprintf(szDir, sizeof(szDir), "/dir%d_%u", level, unsigned(random.next() % nFanout));
+        strPath += szDir;
+    }
+    char szName[48];
+    snprintf(szName, sizeof(szName), "/file%07zu.%s", index,
+             extensions[random.next() % (sizeof(extensions) / sizeof(extensions[0]))]);
+    return strPath + szName;
+}
+
+/** main()
+ */
+
+int main(int argc, char** argv) {
+    CSimpleOpt args(argc, argv, COMMAND_LINE_OPTIONS);
+    while (args.Next())
+    {
+        if (args.LastError() != SO_SUCCESS)
+        {
+            cerr << "Invalid argument: " << args.OptionText() << endl;
+            return -1;
+        }
+
+        switch (args.OptionId())
+        {
+            case OPT_HELP:
+                showUsage(argv[0]);
+                return 0;
+
+            case OPT_QUIET:     bQuiet = true; break;
+            case OPT_OUTPUT:    strOutput = args.OptionArg(); break;
+            case OPT_FILES:     nFiles = strtoul(args.OptionArg(), NULL, 10); break;
+            case OPT_MINSIZE:   nMinSize = strtoull(args.OptionArg(), NULL, 10); break;
+            case OPT_MAXSIZE:   nMaxSize = strtoull(args.OptionArg(), NULL, 10); break;
+            case OPT_DEPTH:     nDepth = max(1, atoi(args.OptionArg())); break;
+            case OPT_FANOUT:    nFanout = max(1, atoi(args.OptionArg())); break;
+            case OPT_CHUNKSIZE: nChunkSize = max<size_t>(1, strtoul(args.OptionArg(), NULL, 10)); break;
+            case OPT_SEED:      nSeed = unsigned(strtoul(args.OptionArg(), NULL, 10)); break;
+            case OPT_MANIFEST:  strManifest = args.OptionArg(); break;
+
+            case OPT_COMPRESS:
+                if (string(args.OptionArg()) == "zlib") {
+                    bCompress = true;
+                } else if (string(args.OptionArg()) == "none") {
+                    bCompress = false;
+                } else {
+                    cerr << "Invalid compression: " << args.OptionArg() << endl;
+                    return -1;
+                }
+                break;
+        }
+    }
+
+    if (nMinSize > nMaxSize)
+        swap(nMinSize, nMaxSize);
+
+    if (!makeDirectory(strOutput) || !makeDirectory(strOutput + "/HeroesData") ||
+        !makeDirectory(strOutput + "/HeroesData/data") || !makeDirectory(strOutput + "/HeroesData/config")) {
+        cerr << "Failed to create '" << strOutput << "'" << endl;
+        return -2;
+    }
+
+    // The files themselves, and the root file naming them
+    tRandom random(nSeed);
+    tArchiveWriter archives;
+    string strRoot = "#MD5|CHUNK_ID|FILENAME|INSTALLPATH\n";
+    tBytes content;
+    uint64_t totalBytes = 0;
+    tManifest manifest;
+
+    for (size_t i = 0; i < nFiles; ++i) {
+        // Log-uniform sizes: many small files, a few big ones
+        double low = log((double) max(nMinSize, 1ULL)), high = log((double) max(nMaxSize, 1ULL));
+        uint64_t size = (nMaxSize == 0) ? 0 : uint64_t(exp(low + (high - low) * random.real()));
+        size = max<uint64_t>(nMinSize, min<uint64_t>(nMaxSize, size));
+
+        content.resize(size_t(size));
+        fillContent(random, content.data(), content.size());
+
+        tStoredFile stored;
+        if (!archives.store(content.data(), content.size(), bCompress, stored)) {
+            cerr << "Failed to write the data archives in '" << strOutput << "'" << endl;
+            return -3;
+        }
+        totalBytes += size;
+
+        string strPath = makePath(random, i);
+        strRoot += toHex(stored.ckey, MD5_DIGEST_SIZE) + "|0|" + strPath + "|" + strPath + "\n";
+        manifest.add(strPath.c_str(), size, stored.ckey);
+    }
+
+    tStoredFile root;
+    if (!archives.store((const unsigned char *) strRoot.data(), strRoot.size(), bCompress, root)) {
+        cerr << "Failed to write the data archives in '" << strOutput << "'" << endl;
+        return -3;
+    }
+
+    // ENCODING lists everything stored so far, and is found by its encoding
+    // key from the build config, so it does not list itself
+    tBytes encoding = buildEncoding(archives.files);
+    tStoredFile encodingFile;
+    if (!archives.store(encoding.data(), encoding.size(), bCompress, encodingFile) || !archives.close() ||
+        !writeIndexFiles(archives.files)) {
+        cerr << "Failed to write the data archives in '" << strOutput << "'" << endl;
+        return -3;
+    }
+
+    unsigned char cdnKey[MD5_DIGEST_SIZE], buildKey[MD5_DIGEST_SIZE];
+    string strCdnConfig = "# CDN Configuration\n\narchives = \n";
+    string strBuildConfig = "# Build Configuration\n\n"
+        "root = " + toHex(root.ckey, MD5_DIGEST_SIZE) + "\n"
+        "encoding = " + toHex(encodingFile.ckey, MD5_DIGEST_SIZE) + " " + toHex(encodingFile.ekey, MD5_DIGEST_SIZE) + "\n"
+        "encoding-size = " + to_string(encodingFile.contentSize) + " " + to_string(encodingFile.encodedSize) + "\n"
+        "build-name = storm-extract synthetic storage\n"
+        "build-product = Hero\n";
+    string strBuildInfo = "Branch!STRING:0|Active!DEC:1|Build Key!HEX:16|CDN Key!HEX:16|Install Key!HEX:16|"
+                          "IM Size!DEC:4|CDN Path!STRING:0|CDN Hosts!STRING:0|Tags!STRING:0|Armadillo!STRING:0|"
+                          "Last Activated!STRING:0|Version!STRING:0\n";
+
+    if (!writeConfig(strCdnConfig, cdnKey) || !writeConfig(strBuildConfig, buildKey)) {
+        cerr << "Failed to write the configs in '" << strOutput << "'" << endl;
+        return -3;
+    }
+    strBuildInfo += "us|1|" + toHex(buildKey, MD5_DIGEST_SIZE) + "|" + toHex(cdnKey, MD5_DIGEST_SIZE) +
+                    "||||||||0.0.0.0\n";
+    if (!writeFile(strOutput + "/.build.info", strBuildInfo.data(), strBuildInfo.size())) {
+        cerr << "Failed to write '" << strOutput << "/.build.info'" << endl;
+        return -3;
+    }
+
+    if (!strManifest.empty() && !manifest.write(strManifest.c_str())) {
+        cerr << "Failed to write the manifest to '" << strManifest << "'" << endl;
+        return -3;
+    }
+
+    if (!bQuiet) {
+        cout << "  " << nFiles << " files, " << totalBytes << " bytes, written to '" << strOutput << "'" << endl;
+    }
+    return 0;
+}
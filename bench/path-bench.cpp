@@ -0,0 +1,376 @@
+/*****************************************************************************/
+/* path-bench.cpp                            Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* time the per-entry search predicate and destination path building         */
+/*****************************************************************************/
+
+#include "../include/SimpleOpt.h"
+#include "filter.h"
+#include "match.h"
+#include "paths.h"
+#include "stats.h"
+
+#include <ctype.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Every allocation in the process goes through here, so a step's
+ * allocations per entry are the difference of the counter around it.
+ */
+static size_t nAllocations = 0;
+
+void *operator new(size_t size) {
+    ++nAllocations;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+// All the global variables
+size_t nEntries = 200000;
+int nIterations = 5;
+unsigned int nSeed = 1;
+string strDestination;      // Empty for a temporary directory
+bool bLowerCase = false;
+tSearchFilter searchFilter;
+
+enum {
+    OPT_HELP,
+    OPT_ENTRIES,
+    OPT_ITERATIONS,
+    OPT_SEED,
+    OPT_DEST,
+    OPT_LOWERCASE,
+    OPT_SEARCH,
+    OPT_FILEEXT,
+    OPT_FILEPTRN,
+    OPT_IGNORECASE
+};
+
+const CSimpleOpt::SOption COMMAND_LINE_OPTIONS[] = {
+    { OPT_HELP,             "-h",               SO_NONE    },
+    { OPT_HELP,             "--help",           SO_NONE    },
+    { OPT_ENTRIES,          "--entries",        SO_REQ_SEP },
+    { OPT_ITERATIONS,       "-n",               SO_REQ_SEP },
+    { OPT_ITERATIONS,       "--iterations",     SO_REQ_SEP },
+    { OPT_SEED,             "--seed",           SO_REQ_SEP },
+    { OPT_DEST,             "-o",               SO_REQ_SEP },
+    { OPT_DEST,             "--out",            SO_REQ_SEP },
+    { OPT_LOWERCASE,        "-c",               SO_NONE    },
+    { OPT_LOWERCASE,        "--lowercase",      SO_NONE    },
+    { OPT_SEARCH,           "-s",               SO_REQ_SEP },
+    { OPT_SEARCH,           "--search",         SO_REQ_SEP },
+    { OPT_FILEEXT,          "-t",               SO_REQ_SEP },
+    { OPT_FILEEXT,          "--filetype",       SO_REQ_SEP },
+    { OPT_FILEPTRN,         "-f",               SO_REQ_SEP },
+    { OPT_FILEPTRN,         "--filename",       SO_REQ_SEP },
+    { OPT_IGNORECASE,       "--ignore-case",    SO_NONE    },
+
+    SO_END_OF_OPTIONS
+};
+
+/* FUNCTIONS */
+void showUsage(const std::string &pathToExecutable) {
+    cout << "Usage: " << pathToExecutable << " [options]" << endl
+         << endl
+         << "Times the work storm-extract does for every entry of the file table, on" << endl
+         << "generated paths, and counts the allocations it makes.  Every substring" << endl
+         << "matcher the CPU can run is first checked against std::string::find()." << endl
+         << endl
+         << "        --entries <N>         Paths to generate (default: 200000)" << endl
+         << "    -n, --iterations <N>      Runs of each step, the best is reported (default: 5)" << endl
+         << "        --seed <N>            Seed for the generated paths (default: 1)" << endl
+         << "    -o, --out <PATH>          Where the directories are created (default: a temporary directory)" << endl
+         << "    -c, --lowercase           Build lowercase destination paths" << endl
+         << "    -s, --search <STRING>     Filter on the full path" << endl
+         << "    -t, --filetype <STRING>   Filter on the extension" << endl
+         << "    -f, --filename <STRING>   Filter on the file name" << endl
+         << "        --ignore-case         Filters ignore case" << endl;
+}
+
+// xorshift64*, the same generator casc-generate uses
+struct tRandom {
+    uint64_t state;
+
+    explicit tRandom(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {
+    }
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+};
+
+struct tPath {
+    string strFullPath;
+    size_t plainOffset;
+};
+
+/* Paths shaped like the game's: mixed case, 3 to 8 levels deep, with
+ * about 32 files per directory, files of a directory not next to each other.
+ */
+vector<tPath> makePaths(size_t count) {
+    static const char *directories[] = {
+        "mods", "heroes.stormmod", "base.stormdata", "Assets", "Textures", "Sounds",
+        "UI", "Layout", "GameData", "Models", "Effects", "enUS.stormdata", "LocalizedData",
+        "heroesdata.stormmod", "Heroes", "Abathur", "Cinematics", "Portraits"
+    };
+    static const char *extensions[] = { "xml", "dds", "ogg", "m3", "txt", "wav", "galaxy", "m3a", "StormLayout" };
+    const size_t nDirectories = sizeof(directories) / sizeof(directories[0]);
+    const size_t nExtensions = sizeof(extensions) / sizeof(extensions[0]);
+
+    tRandom random(nSeed);
+    vector<string> parents(count / 32 + 1);
+    for (size_t i = 0; i < parents.size(); ++i) {
+        int depth = 3 + int(random.next() % 6);
+        for (int level = 0; level < depth; ++level) {
+            parents[i] += directories[random.next() % nDirectories];
+            parents[i] += '/';
+        }
+    }
+
+    vector<tPath> paths(count);
+    for (size_t i = 0; i < count; ++i) {
+        string &strPath = paths[i].strFullPath;
+        strPath = parents[random.next() % parents.size()];
+        paths[i].plainOffset = strPath.size();
+
+        char szName[48];
+        snprintf(szName, sizeof(szName), "File_%06u_%zu.%s", unsigned(random.next() % 1000000), i,
+                 extensions[random.next() % nExtensions]);
+        strPath += szName;
+    }
+    return paths;
+}
+
+// ASCII lowercase copy, what the case-insensitive matchers compare
+string foldString(const char *szText, size_t nText) {
+    string ret(szText, nText);
+    for (size_t i = 0; i < ret.size(); ++i)
+        ret[i] = foldCase(ret[i]);
+    return ret;
+}
+
+/* The vector matchers only pay off if they agree with the scalar one, and
+ * the tier picked at runtime is the only one a run ever exercises.  So
+ * every tier this CPU can run is compared with std::string::find() on the
+ * generated paths, before anything is timed: needles cut from other paths
+ * (found often, at every alignment, up to past the vector block sizes),
+ * with their case flipped at random, searched from a random start.
+ *
+ * @return How many results differed, each one is printed
+ */
+size_t checkMatchers(const vector<tPath> &paths) {
+    tMatchDispatch tiers[MATCH_TIER_COUNT];
+    size_t nTiers = matchTiers(tiers);
+    tRandom random(nSeed);
+    size_t nChecks = 0;
+    size_t nFailures = 0;
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const string &strHay = paths[i].strFullPath;
+        size_t start = size_t(random.next() % (strHay.size() + 1));
+        const char *hay = strHay.data() + start;
+        size_t n = strHay.size() - start;
+
+        const string &strOther = paths[random.next() % paths.size()].strFullPath;
+        size_t from = size_t(random.next() % strOther.size());
+        string strNeedle = strOther.substr(from, size_t(random.next() % 72));
+        if (random.next() % 2) {
+            for (size_t j = 0; j < strNeedle.size(); ++j) {
+                if (random.next() % 2 && isalpha((unsigned char) strNeedle[j]))
+                    strNeedle[j] ^= 0x20;
+            }
+        }
+        const char *needle = strNeedle.data();
+        size_t m = strNeedle.size();
+
+        size_t expected = string(hay, n).find(strNeedle);
+        size_t expectedFolded = foldString(hay, n).find(foldString(needle, m));
+        size_t nSame = min(n, m);
+        bool bExpectedEqual = foldString(hay, nSame) == foldString(needle, nSame);
+
+        for (size_t t = 0; t < nTiers; ++t) {
+            const char *found = tiers[t].find(hay, n, needle, m);
+            const char *foundFolded = tiers[t].findIgnoreCase(hay, n, needle, m);
+            size_t got = found ? size_t(found - hay) : string::npos;
+            size_t gotFolded = foundFolded ? size_t(foundFolded - hay) : string::npos;
+            bool bEqual = tiers[t].equalsIgnoreCase(hay, needle, nSame);
+            nChecks += 3;
+
+            if (got != expected || gotFolded != expectedFolded || bEqual != bExpectedEqual) {
+                if (++nFailures <= 20) {
+                    fprintf(stderr, "MISMATCH (%s): '%s' in '%s': find %zd (expected %zd), ignoring case %zd (expected %zd), "
+                            "equal %d (expected %d)\n", tiers[t].szName, strNeedle.c_str(), string(hay, n).c_str(),
+                            ssize_t(got), ssize_t(expected), ssize_t(gotFolded), ssize_t(expectedFolded),
+                            int(bEqual), int(bExpectedEqual));
+                }
+            }
+        }
+    }
+
+    printf("matchers:");
+    for (size_t t = 0; t < nTiers; ++t)
+        printf(" %s", tiers[t].szName);
+    printf(", %zu checks against std::string::find(), %zu mismatches\n", nChecks, nFailures);
+    return nFailures;
+}
+
+struct tResult {
+    const char *szName;
+    double best;
+    size_t allocations;
+    size_t checksum;    // Keeps the compiler from dropping the work
+};
+
+template <typename Step>
+tResult measure(const char *szName, const vector<tPath> &paths, Step step) {
+    tResult result = { szName, 1e30, 0, 0 };
+    for (int iteration = 0; iteration < nIterations; ++iteration) {
+        size_t nBefore = nAllocations;
+        size_t checksum = 0;
+        double start = tStats::wallClock();
+        for (size_t i = 0; i < paths.size(); ++i)
+            checksum += step(paths[i]);
+        result.best = min(result.best, tStats::wallClock() - start);
+        result.allocations = nAllocations - nBefore;
+        result.checksum = checksum;
+    }
+    return result;
+}
+
+void report(const tResult &result, size_t count) {
+    printf("  %-16s %10.1f ns/entry %8.2f allocations/entry  (%zu)\n", result.szName,
+           result.best * 1e9 / count, double(result.allocations) / count, result.checksum);
+}
+
+int removeEntry(const char *szPath, const struct stat *, int, struct FTW *) {
+    return remove(szPath);
+}
+
+/** main()
+ */
+
+int main(int argc, char** argv) {
+    CSimpleOpt args(argc, argv, COMMAND_LINE_OPTIONS);
+    while (args.Next())
+    {
+        if (args.LastError() != SO_SUCCESS)
+        {
+            cerr << "Invalid argument: " << args.OptionText() << endl;
+            return -1;
+        }
+
+        switch (args.OptionId())
+        {
+            case OPT_HELP:
+                showUsage(argv[0]);
+                return 0;
+
+            case OPT_ENTRIES:
+                nEntries = max(1, atoi(args.OptionArg()));
+                break;
+
+            case OPT_ITERATIONS:
+                nIterations = max(1, atoi(args.OptionArg()));
+                break;
+
+            case OPT_SEED:
+                nSeed = (unsigned int) strtoul(args.OptionArg(), NULL, 10);
+                break;
+
+            case OPT_DEST:
+                strDestination = args.OptionArg();
+                if (strDestination.empty() || strDestination[strDestination.size() - 1] != '/')
+                    strDestination += '/';
+                break;
+
+            case OPT_LOWERCASE:
+                bLowerCase = true;
+                break;
+
+            case OPT_SEARCH:
+                searchFilter.strSearchPattern = args.OptionArg();
+                break;
+
+            case OPT_FILEEXT:
+                searchFilter.bFileExt = true;
+                searchFilter.strFileExt = args.OptionArg();
+                break;
+
+            case OPT_FILEPTRN:
+                searchFilter.bPattern = true;
+                searchFilter.strFilePattern = args.OptionArg();
+                break;
+
+            case OPT_IGNORECASE:
+                searchFilter.bIgnoreCase = true;
+                break;
+        }
+    }
+
+    vector<tPath> paths = makePaths(nEntries);
+
+    // A wrong answer found fast is no result, fail the benchmark instead
+    if (checkMatchers(paths) > 0) {
+        cerr << "The matchers disagree with std::string::find(), see above" << endl;
+        return -3;
+    }
+
+    tResult filter = measure("filter", paths, [](const tPath &path) -> size_t {
+        const string &strPath = path.strFullPath;
+        return searchFilter.matches(strPath.data(), strPath.size(), strPath.data() + path.plainOffset,
+                                    strPath.size() - path.plainOffset, 0) ? 1 : 0;
+    });
+
+    // What extractFile() does before it opens anything: the destination
+    // name, then its parent directories.  The first run creates them, the
+    // best run is the usual case of directories already seen.
+    bool bTemporary = strDestination.empty();
+    if (bTemporary) {
+        char szTemporary[] = "/tmp/path-bench.XXXXXX";
+        if (!mkdtemp(szTemporary)) {
+            cerr << "Failed to create a temporary directory" << endl;
+            return -2;
+        }
+        strDestination = string(szTemporary) + "/";
+    }
+
+    tDestPath destPath;
+    destPath.setRoot(strDestination);
+    tResult destName = measure("dest path", paths, [&destPath](const tPath &path) -> size_t {
+        return destPath.build(path.strFullPath.data(), path.strFullPath.size(), bLowerCase).size();
+    });
+
+    tResult directories = measure("dest directories", paths, [&destPath](const tPath &path) -> size_t {
+        destPath.build(path.strFullPath.data(), path.strFullPath.size(), bLowerCase);
+        return destPath.createDirectories() ? destPath.directoryCount() : 0;
+    });
+
+    if (bTemporary)
+        nftw(strDestination.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+
+    printf("%zu entries, best of %d:\n", paths.size(), nIterations);
+    report(filter, paths.size());
+    report(destName, paths.size());
+    report(directories, paths.size());
+    return 0;
+}
@@ -5,11 +5,31 @@ module.exports = {
         return bindings.getVersion();
     },
 
-    extractFiles: function(Source, Destination, Files) {
-        return bindings.extractFiles(Source, Destination, Files);
+    extractFiles: function(Source, Destination, Files, Options) {
+        return bindings.extractFiles(Source, Destination, Files, Options || {});
     },
 
-    listFiles: function(Directory) {
-        return bindings.listFiles(Directory);
+    listFiles: function(Directory, Options) {
+        return bindings.listFiles(Directory, Options || {});
+    },
+
+    readFile: function(Source, File) {
+        return bindings.readFile(Source, File);
+    },
+
+    read: function(Source, File, Offset, Length) {
+        return bindings.read(Source, File, Offset, Length);
+    },
+
+    setCacheSize: function(Bytes) {
+        return bindings.setCacheSize(Bytes);
+    },
+
+    getCacheStats: function() {
+        return bindings.getCacheStats();
+    },
+
+    close: function() {
+        return bindings.close();
     }
 };
@@ -0,0 +1,389 @@
+/*****************************************************************************/
+/* blockcache.h                              Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* an LRU cache of decompressed file blocks, for long-lived processes        */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_BLOCKCACHE_H
+#define STORMEXTRACT_BLOCKCACHE_H
+
+#include "../CascLib/src/CascLib.h"
+#include "match.h"
+#include "md5.h"
+#include "results.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Decompressed bytes per cached block; CascLib decodes whole frames anyway
+static const size_t CACHE_BLOCK_SIZE = 0x40000;
+
+/* Decompressed blocks of files, least recently used dropped first.
+ *
+ * Blocks are keyed by content key and block number, so files with the same
+ * contents share their blocks.  A block is handed out as a shared pointer:
+ * evicting it never pulls it from under a reader.  Any thread may use it.
+ *
+ * Callers that only know a path get its content key from an index of the
+ * whole storage, built by one enumeration on first use: CascLib checks a
+ * find mask against every name, so searching for each path would walk the
+ * storage every time.  The index takes 24 bytes a file and is charged to
+ * the budget like the blocks; when it would take more than half of it, it
+ * is not built and paths stand in for content keys.
+ *
+ * With a budget of 0 (the default) nothing is kept.
+ */
+class tBlockCache {
+public:
+    typedef std::shared_ptr<const std::vector<char> > tBlock;
+
+    tBlockCache() : nBudget(0), nBytes(0), nHits(0), nMisses(0), nEvictions(0), bKeysBuilt(false) {
+    }
+
+    // Bytes to keep at most, extra blocks are dropped now
+    void setBudget(size_t nNewBudget) {
+        // The index may not fit any more, or may now; built again when needed
+        std::lock_guard<std::mutex> keysLock(keysMutex);
+        std::lock_guard<std::mutex> lock(mutex);
+        nBudget = nNewBudget;
+        dropKeys();
+        evict();
+    }
+
+    bool isEnabled() const {
+        return nBudget > 0;
+    }
+
+    // The block, or NULL (a miss) if it is not cached
+    tBlock get(const unsigned char *key, unsigned long long block) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tIndex::iterator found = index.find(makeKey(key, block));
+        if (found == index.end()) {
+            nMisses++;
+            return tBlock();
+        }
+        nHits++;
+        lru.splice(lru.begin(), lru, found->second);
+        return found->second->data;
+    }
+
+    void put(const unsigned char *key, unsigned long long block, const tBlock &data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (nBudget == 0 || data->size() > nBudget)
+            return;
+
+        tKey blockKey = makeKey(key, block);
+        tIndex::iterator found = index.find(blockKey);
+        if (found != index.end()) {
+            // Read twice by two threads, keep the first copy
+            lru.splice(lru.begin(), lru, found->second);
+            return;
+        }
+
+        tEntry entry = { blockKey, data };
+        lru.push_front(entry);
+        index[blockKey] = lru.begin();
+        nBytes += data->size();
+        evict();
+    }
+
+    // Also forgets the storage the index was built from
+    void clear() {
+        std::lock_guard<std::mutex> keysLock(keysMutex);
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.clear();
+        index.clear();
+        dropKeys();
+        nBytes = 0;
+    }
+
+    /* The content key of a path of hStorage, from the index.
+     *
+     * @return false if there is none: no budget, an index too large for
+     *         it, or a path the storage does not name (or not just once)
+     */
+    bool contentKey(HANDLE hStorage, const char *szFullPath, unsigned char *key) {
+        std::lock_guard<std::mutex> keysLock(keysMutex);
+        if (!bKeysBuilt)
+            buildKeys(hStorage);
+
+        tPathKey wanted;
+        wanted.pathHash = hashPath(szFullPath, strlen(szFullPath));
+        std::vector<tPathKey>::const_iterator found = std::lower_bound(keys.begin(), keys.end(), wanted);
+        if (found == keys.end() || found->pathHash != wanted.pathHash || !hasContentKey(found->key))
+            return false;
+        memcpy(key, found->key, CONTENT_KEY_SIZE);
+        return true;
+    }
+
+    // Counters since the cache was created
+    struct tCounters {
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+        size_t bytes;               // Of the blocks and the path index
+        size_t blocks;
+        size_t budget;
+    };
+
+    tCounters counters() {
+        std::lock_guard<std::mutex> lock(mutex);
+        tCounters ret = { nHits, nMisses, nEvictions, nBytes, lru.size(), nBudget };
+        return ret;
+    }
+
+private:
+    struct tKey {
+        unsigned char key[CONTENT_KEY_SIZE];
+        unsigned long long block;
+
+        bool operator==(const tKey &other) const {
+            return block == other.block && memcmp(key, other.key, CONTENT_KEY_SIZE) == 0;
+        }
+    };
+
+    // Content keys are MD5s, any eight of their bytes make a good hash
+    struct tKeyHash {
+        size_t operator()(const tKey &key) const {
+            unsigned long long hash;
+            memcpy(&hash, key.key, sizeof(hash));
+            return size_t(hash ^ (key.block * 0x9E3779B97F4A7C15ULL));
+        }
+    };
+
+    struct tEntry {
+        tKey key;
+        tBlock data;
+    };
+
+    struct tPathKey {
+        unsigned long long pathHash;
+        unsigned char key[CONTENT_KEY_SIZE];    // All zero if the hash is ambiguous
+
+        bool operator<(const tPathKey &other) const {
+            return pathHash < other.pathHash;
+        }
+    };
+
+    typedef std::list<tEntry> tList;
+    typedef std::unordered_map<tKey, tList::iterator, tKeyHash> tIndex;
+
+    std::mutex mutex;
+    tList lru;                      // Most recently used first
+    tIndex index;
+    size_t nBudget;
+    size_t nBytes;
+    unsigned long long nHits;
+    unsigned long long nMisses;
+    unsigned long long nEvictions;
+
+    // Taken before mutex, by whoever takes both
+    std::mutex keysMutex;
+    std::vector<tPathKey> keys;     // By path hash
+    bool bKeysBuilt;                // Or found too large to keep
+
+    static tKey makeKey(const unsigned char *key, unsigned long long block) {
+        tKey ret;
+        memcpy(ret.key, key, CONTENT_KEY_SIZE);
+        ret.block = block;
+        return ret;
+    }
+
+    // FNV-1a of the case-folded path, as CascLib matches paths without case
+    static unsigned long long hashPath(const char *szPath, size_t nPath) {
+        unsigned long long hash = 0xCBF29CE484222325ULL;
+        for (size_t i = 0; i < nPath; ++i) {
+            char c = foldCase(szPath[i]);
+            hash = (hash ^ (unsigned char) ((c == '\\') ? '/' : c)) * 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    // With keysMutex held
+    void buildKeys(HANDLE hStorage) {
+        bKeysBuilt = true;
+        size_t nLimit;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            nLimit = nBudget / 2 / sizeof(tPathKey);
+        }
+        if (nLimit == 0)
+            return;
+
+        CASC_FIND_DATA findData;
+        HANDLE hFind = CascFindFirstFile(hStorage, "*", &findData, NULL);
+        if (!hFind)
+            return;
+        do {
+            if (keys.size() == nLimit) {
+                keys.clear();
+                break;
+            }
+            tPathKey entry;
+            entry.pathHash = hashPath(findData.szFileName, strlen(findData.szFileName));
+            memcpy(entry.key, findData.EncodingKey, CONTENT_KEY_SIZE);
+            keys.push_back(entry);
+        } while (CascFindNextFile(hFind, &findData));
+        CascFindClose(hFind);
+
+        // A hash named with two keys (other locales, or paths colliding) is no use
+        std::sort(keys.begin(), keys.end());
+        for (size_t begin = 0, end; begin < keys.size(); begin = end) {
+            bool bAmbiguous = false;
+            for (end = begin + 1; end < keys.size() && keys[end].pathHash == keys[begin].pathHash; ++end)
+                bAmbiguous |= memcmp(keys[end].key, keys[begin].key, CONTENT_KEY_SIZE) != 0;
+            for (size_t i = begin; bAmbiguous && i < end; ++i)
+                memset(keys[i].key, 0, CONTENT_KEY_SIZE);
+        }
+        std::vector<tPathKey>(keys).swap(keys);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        nBytes += keys.size() * sizeof(tPathKey);
+        evict();
+    }
+
+    // With both locks held
+    void dropKeys() {
+        nBytes -= keys.size() * sizeof(tPathKey);
+        std::vector<tPathKey>().swap(keys);
+        bKeysBuilt = false;
+    }
+
+    void evict() {
+        while (nBytes > nBudget && !lru.empty()) {
+            nBytes -= lru.back().data->size();
+            index.erase(lru.back().key);
+            lru.pop_back();
+            nEvictions++;
+        }
+    }
+};
+
+/* Reads parts of one file, through a tBlockCache.
+ *
+ * The file is only opened on the first miss, so a read served from memory
+ * never touches CascLib.
+ */
+class tCachedFile {
+public:
+    /* @param key   The content key, or NULL to take it from the cache's
+     *              index.  Without one the MD5 of the path is used instead,
+     *              which only shares blocks between reads of the same path.
+     */
+    tCachedFile(tBlockCache &cache, HANDLE hStorage, const char *szFullPath, const unsigned char *key)
+        : cache(cache), hStorage(hStorage), szFullPath(szFullPath), hFile(NULL), nFileSize(0) {
+        if (key && hasContentKey(key))
+            memcpy(this->key, key, CONTENT_KEY_SIZE);
+        else if (!cache.isEnabled() || !cache.contentKey(hStorage, szFullPath, this->key))
+            tMD5::hash(szFullPath, strlen(szFullPath), this->key);
+    }
+
+    ~tCachedFile() {
+        if (hFile)
+            CascCloseFile(hFile);
+    }
+
+    /* Block N of the decompressed file, shorter than CACHE_BLOCK_SIZE (even
+     * empty) at the end of the file.
+     *
+     * @return NULL if the file could not be opened or read
+     */
+    tBlockCache::tBlock block(unsigned long long n) {
+        tBlockCache::tBlock data = cache.get(key, n);
+        if (data)
+            return data;
+
+        if (!hFile) {
+            if (!CascOpenFile(hStorage, szFullPath, CASC_LOCALE_ALL, 0, &hFile)) {
+                hFile = NULL;
+                return data;
+            }
+            DWORD dwHigh = 0;
+            DWORD dwLow = CascGetFileSize(hFile, &dwHigh);
+            if (dwLow == CASC_INVALID_SIZE) {
+                CascCloseFile(hFile);
+                hFile = NULL;
+                return data;
+            }
+            nFileSize = ((unsigned long long) dwHigh << 32) | dwLow;
+        }
+
+        // CascLib does not seek past the end, there is nothing there anyway.
+        // Kept all the same: it ends reads of files sized in whole blocks.
+        unsigned long long offset = n * CACHE_BLOCK_SIZE;
+        if (offset >= nFileSize) {
+            data = tBlockCache::tBlock(new std::vector<char>());
+            cache.put(key, n, data);
+            return data;
+        }
+
+        LONG high = LONG(offset >> 32);
+        if (CascSetFilePointer(hFile, LONG(offset & 0xFFFFFFFF), &high, FILE_BEGIN) == CASC_INVALID_POS)
+            return data;
+
+        std::shared_ptr<std::vector<char> > buffer(new std::vector<char>(CACHE_BLOCK_SIZE));
+        size_t nRead = 0;
+        while (nRead < buffer->size()) {
+            DWORD read = 0;
+            if (!CascReadFile(hFile, &(*buffer)[nRead], DWORD(buffer->size() - nRead), &read))
+                return data;
+            if (read == 0)
+                break;
+            nRead += read;
+        }
+        buffer->resize(nRead);
+
+        data = buffer;
+        cache.put(key, n, data);
+        return data;
+    }
+
+    /* Copy LENGTH bytes from OFFSET on into contents, fewer at the end of
+     * the file.  Only the blocks covering them are read.
+     *
+     * @return false if it could not be opened or read
+     */
+    bool read(unsigned long long offset, unsigned long long length, std::vector<char> &contents) {
+        contents.clear();
+        unsigned long long end = (length > ~0ULL - offset) ? ~0ULL : offset + length;
+        if (offset >= end)
+            return true;
+        for (unsigned long long n = offset / CACHE_BLOCK_SIZE; n * CACHE_BLOCK_SIZE < end; ++n) {
+            tBlockCache::tBlock data = block(n);
+            if (!data)
+                return false;
+
+            unsigned long long start = n * CACHE_BLOCK_SIZE;
+            size_t from = size_t((offset > start) ? offset - start : 0);
+            size_t to = size_t(std::min<unsigned long long>(data->size(), end - start));
+            if (from < to)
+                contents.insert(contents.end(), data->begin() + from, data->begin() + to);
+            if (data->size() < CACHE_BLOCK_SIZE)
+                break;
+        }
+        return true;
+    }
+
+    bool readAll(std::vector<char> &contents) {
+        return read(0, ~0ULL, contents);
+    }
+
+private:
+    tBlockCache &cache;
+    HANDLE hStorage;
+    const char *szFullPath;
+    unsigned char key[CONTENT_KEY_SIZE];
+    HANDLE hFile;
+    unsigned long long nFileSize;   // Known once the file is open
+
+    tCachedFile(const tCachedFile &);
+    tCachedFile &operator=(const tCachedFile &);
+};
+
+#endif
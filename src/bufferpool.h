@@ -0,0 +1,219 @@
+/*****************************************************************************/
+/* bufferpool.h                              Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* a thread-safe pool of aligned, reusable I/O buffers                       */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_BUFFERPOOL_H
+#define STORMEXTRACT_BUFFERPOOL_H
+
+#include <stdlib.h>
+
+#include <mutex>
+#include <vector>
+
+class tBufferPool;
+
+/* A buffer borrowed from a tBufferPool, given back when it goes away.
+ *
+ * It may be larger than asked for (the size of its class), never smaller.
+ * Move it around, it cannot be copied.
+ */
+class tBuffer {
+public:
+    tBuffer() : pool(NULL), memory(NULL), nSize(0), sizeClass(0) {
+    }
+
+    tBuffer(tBuffer &&other) : pool(other.pool), memory(other.memory), nSize(other.nSize), sizeClass(other.sizeClass) {
+        other.memory = NULL;
+        other.nSize = 0;
+    }
+
+    tBuffer &operator=(tBuffer &&other);
+
+    ~tBuffer() {
+        release();
+    }
+
+    char *data() const {
+        return memory;
+    }
+
+    size_t size() const {
+        return nSize;
+    }
+
+    // False if nothing was borrowed, or allocating failed
+    explicit operator bool() const {
+        return memory != NULL;
+    }
+
+    // Give it back now
+    void release();
+
+private:
+    friend class tBufferPool;
+
+    tBufferPool *pool;
+    char *memory;
+    size_t nSize;
+    size_t sizeClass;
+
+    tBuffer(const tBuffer &);
+    tBuffer &operator=(const tBuffer &);
+};
+
+/* Buffers by size class (64KB, 256KB, 1MB, 4MB, 16MB), page aligned so
+ * they suit O_DIRECT.  Not vmsplice(): a pipe may still hold the pages of a
+ * buffer after it was given back (see tPipeOutput).
+ *
+ * A returned buffer is kept on its class's free list for the next caller of
+ * any thread, so a run allocates about as many buffers as it ever used at
+ * once.  Requests above the largest class are allocated and freed each
+ * time.  shared() is the pool every read and write path borrows from.
+ */
+class tBufferPool {
+public:
+    static const size_t ALIGNMENT = 0x1000;
+    static const size_t SMALLEST_CLASS = 0x10000;
+    static const size_t CLASS_COUNT = 5;            // Each four times the previous one
+
+    struct tCounters {
+        unsigned long long acquired;    // Buffers handed out
+        unsigned long long allocated;   // Of those, the ones the free lists could not serve
+        size_t buffersInUse;
+        size_t bytesInUse;
+        size_t peakBuffersInUse;
+        size_t peakBytesInUse;
+        size_t bytesPooled;             // Free, kept for reuse
+    };
+
+    tBufferPool() {
+        tCounters zero = { 0, 0, 0, 0, 0, 0, 0 };
+        counts = zero;
+    }
+
+    ~tBufferPool() {
+        trim();
+    }
+
+    static tBufferPool &shared() {
+        static tBufferPool pool;
+        return pool;
+    }
+
+    static size_t classSize(size_t sizeClass) {
+        return SMALLEST_CLASS << (2 * sizeClass);
+    }
+
+    /* A buffer of at least nSize bytes.
+     *
+     * @return An empty tBuffer if it could not be allocated
+     */
+    tBuffer acquire(size_t nSize) {
+        size_t sizeClass = 0;
+        while (sizeClass < CLASS_COUNT && classSize(sizeClass) < nSize)
+            ++sizeClass;
+
+        tBuffer buffer;
+        buffer.pool = this;
+        buffer.sizeClass = sizeClass;
+        buffer.nSize = (sizeClass < CLASS_COUNT) ? classSize(sizeClass) : nSize;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (sizeClass < CLASS_COUNT && !freeLists[sizeClass].empty()) {
+                buffer.memory = freeLists[sizeClass].back();
+                freeLists[sizeClass].pop_back();
+                counts.bytesPooled -= buffer.nSize;
+                taken(buffer.nSize);
+                return buffer;
+            }
+        }
+
+        void *memory = NULL;
+        if (posix_memalign(&memory, ALIGNMENT, buffer.nSize ? buffer.nSize : 1) != 0) {
+            buffer.nSize = 0;
+            return buffer;
+        }
+        buffer.memory = (char *) memory;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counts.allocated++;
+        taken(buffer.nSize);
+        return buffer;
+    }
+
+    // Free what the free lists hold
+    void trim() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < CLASS_COUNT; ++i) {
+            for (size_t j = 0; j < freeLists[i].size(); ++j)
+                free(freeLists[i][j]);
+            freeLists[i].clear();
+        }
+        counts.bytesPooled = 0;
+    }
+
+    tCounters counters() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counts;
+    }
+
+private:
+    friend class tBuffer;
+
+    std::mutex mutex;
+    std::vector<char *> freeLists[CLASS_COUNT];
+    tCounters counts;
+
+    // With the lock held
+    void taken(size_t nSize) {
+        counts.acquired++;
+        counts.buffersInUse++;
+        counts.bytesInUse += nSize;
+        if (counts.buffersInUse > counts.peakBuffersInUse)
+            counts.peakBuffersInUse = counts.buffersInUse;
+        if (counts.bytesInUse > counts.peakBytesInUse)
+            counts.peakBytesInUse = counts.bytesInUse;
+    }
+
+    void giveBack(char *memory, size_t nSize, size_t sizeClass) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counts.buffersInUse--;
+            counts.bytesInUse -= nSize;
+            if (sizeClass < CLASS_COUNT) {
+                freeLists[sizeClass].push_back(memory);
+                counts.bytesPooled += nSize;
+                return;
+            }
+        }
+        free(memory);
+    }
+
+    tBufferPool(const tBufferPool &);
+    tBufferPool &operator=(const tBufferPool &);
+};
+
+inline tBuffer &tBuffer::operator=(tBuffer &&other) {
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        memory = other.memory;
+        nSize = other.nSize;
+        sizeClass = other.sizeClass;
+        other.memory = NULL;
+        other.nSize = 0;
+    }
+    return *this;
+}
+
+inline void tBuffer::release() {
+    if (memory)
+        pool->giveBack(memory, nSize, sizeClass);
+    memory = NULL;
+    nSize = 0;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/*****************************************************************************/
+/* cachehints.h                              Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* read-ahead and page-cache hints for the archives and the extracted files  */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_CACHEHINTS_H
+#define STORMEXTRACT_CACHEHINTS_H
+
+#include "storageorder.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* posix_fadvise() hints for an extraction, for --cache-hints.
+ *
+ * Source side: the planned files are turned into archive ranges, and the
+ * next WINDOW bytes of them are always asked for with WILLNEED, so the
+ * kernel reads ahead of CascLib.  A range is dropped with DONTNEED once its
+ * file is extracted.  CascLib reads through its own descriptors, which
+ * SEQUENTIAL would not reach (it is per descriptor); WILLNEED and DONTNEED
+ * act on the page cache, so descriptors of our own do.
+ *
+ * Output side: DONTNEED on a file just written only starts its writeback,
+ * dirty pages cannot be dropped yet.  So the descriptor is kept for another
+ * LAG files and advised again then, when its pages are clean.
+ *
+ * Without posix_fadvise() (macOS) everything here does nothing.
+ */
+class tCacheHints {
+public:
+    typedef std::function<unsigned long long (size_t index)> tSizeAt;
+
+    static const unsigned long long WINDOW = 64ULL << 20;
+    static const size_t LAG = 16;
+
+    tCacheHints() : bEnabled(false), current(0), nAdvised(0), nAhead(0) {
+    }
+
+    ~tCacheHints() {
+        finish();
+    }
+
+    /* Find the data archives below the game directory.
+     *
+     * @return false if there are none (or no posix_fadvise()), hints stay off
+     */
+    bool open(const std::string &strSource) {
+#ifdef POSIX_FADV_WILLNEED
+        static const char *dataDirectories[] = { "/HeroesData/data/", "/Data/data/" };
+        for (size_t i = 0; i < sizeof(dataDirectories) / sizeof(dataDirectories[0]); ++i) {
+            struct stat info;
+            std::string strDirectory = strSource + dataDirectories[i];
+            if (stat(strDirectory.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+                strDataDirectory = strDirectory;
+                bEnabled = true;
+                return true;
+            }
+        }
+#endif
+        (void) strSource;
+        return false;
+    }
+
+    bool isEnabled() const {
+        return bEnabled;
+    }
+
+    /* The files about to be extracted, in extraction order.
+     *
+     * A file runs to the next planned file of its archive, but no further
+     * than its size plus room for the BLTE header and frame table, so the
+     * files in between that were not asked for are not read.
+     *
+     * @param sizeAt    The decompressed size of file N of the caller's list
+     */
+    void plan(const std::vector<tStorageLocation> &locations, const tSizeAt &sizeAt) {
+        ranges.clear();
+        current = 0;
+        nAdvised = 0;
+        nAhead = 0;
+        for (size_t i = 0; i < locations.size(); ++i) {
+            const tStorageLocation &location = locations[i];
+            unsigned long long size = sizeAt(location.index);
+            tRange range = { location.archive, location.offset, size + size / 1024 + 0x1000 };
+            if (i + 1 < locations.size() && locations[i + 1].archive == location.archive &&
+                locations[i + 1].offset > location.offset) {
+                range.length = std::min(range.length, locations[i + 1].offset - location.offset);
+            }
+            ranges.push_back(range);
+        }
+    }
+
+    // File N of the plan is read next: keep WINDOW bytes ahead of it advised
+    void reading(size_t n) {
+        if (!bEnabled)
+            return;
+        for (; current < n && current < nAdvised; ++current)
+            nAhead -= ranges[current].length;
+        if (nAdvised < n) {
+            nAdvised = n;
+            nAhead = 0;
+        }
+        current = n;
+
+        while (nAdvised < ranges.size() && nAhead < WINDOW) {
+            advise(ranges[nAdvised], HINT_WILLNEED);
+            nAhead += ranges[nAdvised].length;
+            ++nAdvised;
+        }
+    }
+
+    // File N of the plan is extracted, its archive range is not needed again
+    void read(size_t n) {
+        if (bEnabled && n < ranges.size())
+            advise(ranges[n], HINT_DONTNEED);
+    }
+
+    /* An extracted file, before it is closed.
+     *
+     * @return false if flushing it failed
+     */
+    bool written(FILE *file) {
+#ifdef POSIX_FADV_DONTNEED
+        if (!bEnabled)
+            return true;
+        if (fflush(file) != 0)
+            return false;
+        int fd = dup(fileno(file));
+        if (fd < 0)
+            return true;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        pendingOutputs.push_back(fd);
+        if (pendingOutputs.size() > LAG)
+            release();
+#else
+        (void) file;
+#endif
+        return true;
+    }
+
+    // Drop what is still held, also done on destruction
+    void finish() {
+        while (!pendingOutputs.empty())
+            release();
+        for (size_t i = 0; i < archives.size(); ++i) {
+            if (archives[i] >= 0)
+                close(archives[i]);
+        }
+        archives.clear();
+    }
+
+private:
+    struct tRange {
+        unsigned int archive;
+        unsigned long long offset;
+        unsigned long long length;
+    };
+
+    enum { HINT_WILLNEED, HINT_DONTNEED };
+
+    enum { NOT_OPENED = -1, MISSING = -2 };     // Besides descriptors in archives
+
+    bool bEnabled;
+    std::string strDataDirectory;
+    std::vector<tRange> ranges;
+    size_t current;                 // The file being extracted
+    size_t nAdvised;                // Files before this one were asked for
+    unsigned long long nAhead;      // Bytes asked for from current on
+    std::vector<int> archives;      // Descriptor of data.NNN, by NNN
+    std::deque<int> pendingOutputs; // Extracted files whose pages may be dirty
+
+    int archive(unsigned int index) {
+        if (index == NO_ARCHIVE)
+            return MISSING;
+        if (index >= archives.size())
+            archives.resize(index + 1, int(NOT_OPENED));
+        if (archives[index] == NOT_OPENED) {
+            char szName[16];
+            snprintf(szName, sizeof(szName), "data.%03u", index);
+            int fd = ::open((strDataDirectory + szName).c_str(), O_RDONLY);
+            archives[index] = (fd < 0) ? MISSING : fd;
+        }
+        return archives[index];
+    }
+
+    void advise(const tRange &range, int hint) {
+#ifdef POSIX_FADV_WILLNEED
+        int fd = archive(range.archive);
+        if (fd >= 0)
+            posix_fadvise(fd, off_t(range.offset), off_t(range.length),
+                          (hint == HINT_WILLNEED) ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+#else
+        (void) range;
+        (void) hint;
+#endif
+    }
+
+    void release() {
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(pendingOutputs.front(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+        close(pendingOutputs.front());
+        pendingOutputs.pop_front();
+    }
+
+    tCacheHints(const tCacheHints &);
+    tCacheHints &operator=(const tCacheHints &);
+};
+
+#endif
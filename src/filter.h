@@ -0,0 +1,138 @@
+/*****************************************************************************/
+/* filter.h                                  Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* the search predicate shared by the command-line tools and the Node module */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_FILTER_H
+#define STORMEXTRACT_FILTER_H
+
+#include "match.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <string>
+
+struct tSearchFilter {
+    std::string strPrefix;          // Full path must begin with this
+    std::string strSearchPattern;   // Full path must contain this
+    std::string strFilePattern;     // Plain name must contain this
+    std::string strFileExt;         // Plain name must end with this
+    bool bPattern;
+    bool bFileExt;
+    bool bIgnoreCase;               // Fold ASCII case on both sides
+    unsigned long long nMinSize;    // Inclusive size range, in bytes
+    unsigned long long nMaxSize;
+
+    tSearchFilter()
+        : strSearchPattern("/"), bPattern(false), bFileExt(false), bIgnoreCase(false),
+          nMinSize(0), nMaxSize(~0ULL) {
+    }
+
+    bool contains(const char *szHaystack, size_t nHaystack, const std::string &strNeedle) const {
+        return bIgnoreCase ? findSubstringIgnoreCase(szHaystack, nHaystack, strNeedle.data(), strNeedle.size()) != NULL
+                           : findSubstring(szHaystack, nHaystack, strNeedle.data(), strNeedle.size()) != NULL;
+    }
+
+    // Find out if the end of the file name matches the extension.  The name
+    // must be strictly longer, a file called ".xml" has no extension.
+    bool hasExtension(const char *szPlainName, size_t nPlainName) const {
+        if (nPlainName <= strFileExt.size())
+            return false;
+        return bIgnoreCase ? hasSuffixIgnoreCase(szPlainName, nPlainName, strFileExt.data(), strFileExt.size())
+                           : hasSuffix(szPlainName, nPlainName, strFileExt.data(), strFileExt.size());
+    }
+
+    // Whether the full path starts with strPrefix
+    bool hasPrefix(const char *szFullPath, size_t nFullPath) const {
+        if (nFullPath < strPrefix.size())
+            return false;
+        return bIgnoreCase ? equalsIgnoreCase(szFullPath, strPrefix.data(), strPrefix.size())
+                           : memcmp(szFullPath, strPrefix.data(), strPrefix.size()) == 0;
+    }
+
+    // The size is known from the file table, check it before any string work
+    bool matches(const char *szFullPath, size_t nFullPath, const char *szPlainName, size_t nPlainName,
+                 unsigned long long nFileSize) const {
+        if (nFileSize < nMinSize || nFileSize > nMaxSize)
+            return false;
+        if (!strPrefix.empty() && !hasPrefix(szFullPath, nFullPath))
+            return false;
+        if (!contains(szFullPath, nFullPath, strSearchPattern))
+            return false;
+        if (bPattern && !contains(szPlainName, nPlainName, strFilePattern))
+            return false;
+        if (bFileExt && !hasExtension(szPlainName, nPlainName))
+            return false;
+        return true;
+    }
+
+    /* The tightest mask for CascFindFirstFile() that still returns every match.
+     *
+     * CascLib masks only know '*' and '?' and compare ignoring case and slash
+     * direction, so the mask is a prefilter and matches() keeps the final
+     * word.  CascLib still walks every name and checks it against the mask;
+     * all a tighter one saves is handing back entries we would reject anyway.
+     * Only a --table search skips rows, see searchTable().
+     */
+    std::string findMask() const {
+        if (!strPrefix.empty() && isLiteral(strPrefix)) {
+            // The plain name starts after the last separator, so when the
+            // prefix ends with one the extension can never overlap it.
+            char last = strPrefix[strPrefix.size() - 1];
+            if (bFileExt && isLiteral(strFileExt) && (last == '/' || last == '\\'))
+                return strPrefix + "*" + strFileExt;
+            return strPrefix + "*";
+        }
+        if (strSearchPattern != "/" && !strSearchPattern.empty() && isLiteral(strSearchPattern))
+            return "*" + strSearchPattern + "*";
+        if (bFileExt && !strFileExt.empty() && isLiteral(strFileExt))
+            return "*" + strFileExt;
+        if (bPattern && !strFilePattern.empty() && isLiteral(strFilePattern))
+            return "*" + strFilePattern + "*";
+        return "*";
+    }
+
+    static bool isLiteral(const std::string &strText) {
+        return strText.find_first_of("*?") == std::string::npos;
+    }
+};
+
+/* Parse a size such as "512", "64K", "10MB" or "2G" (binary multiples).
+ *
+ * @return false if the text is not a size
+ */
+inline bool parseSize(const char *szText, unsigned long long &nSize) {
+    // strtoull() would take "-1" as the largest size there is
+    if (!isdigit((unsigned char) *szText))
+        return false;
+
+    char *szEnd = NULL;
+    errno = 0;
+    nSize = strtoull(szText, &szEnd, 10);
+    if (errno == ERANGE)
+        return false;
+
+    unsigned int shift = 0;
+    switch (foldCase(*szEnd)) {
+        case 'g': shift = 30; break;
+        case 'm': shift = 20; break;
+        case 'k': shift = 10; break;
+        case 'b': ++szEnd;
+            return *szEnd == 0;
+        default:
+            return *szEnd == 0;
+    }
+    if (nSize > (~0ULL >> shift))
+        return false;
+    nSize <<= shift;
+
+    ++szEnd;
+    if (foldCase(*szEnd) == 'b')
+        ++szEnd;
+    return *szEnd == 0;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*****************************************************************************/
+/* manifest.h                                Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* path, size and MD5 of every extracted file, for --manifest                */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_MANIFEST_H
+#define STORMEXTRACT_MANIFEST_H
+
+#include "md5.h"
+#include "output.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/* The files of an extraction, hashed while they were written.
+ *
+ * extractFile() feeds the MD5 the buffers it writes anyway, so the tree
+ * never has to be read back to be checked.  As CASC content keys are the
+ * MD5 of the contents, the hashes can also be compared with the storage.
+ *
+ * Saved as tab-separated lines, sorted by path:
+ *
+ *     path (below the destination)    size    md5 (hex)
+ */
+class tManifest {
+public:
+    tManifest() : bEnabled(false) {
+    }
+
+    bool bEnabled;
+
+    void add(const char *szPath, unsigned long long size, const unsigned char digest[MD5_DIGEST_SIZE]) {
+        tEntry entry;
+        entry.strPath = szPath;
+        entry.size = size;
+        memcpy(entry.digest, digest, MD5_DIGEST_SIZE);
+        entries.push_back(entry);
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    /* @return false if the file could not be written
+     */
+    bool write(const char *szFileName) {
+        std::sort(entries.begin(), entries.end(), [](const tEntry &a, const tEntry &b) {
+            return a.strPath < b.strPath;
+        });
+
+        FILE *file = fopen(szFileName, "w");
+        if (!file)
+            return false;
+
+        {
+            tOutput out(file);
+            for (size_t i = 0; i < entries.size(); ++i) {
+                out.write(entries[i].strPath);
+                out.put('\t');
+                out.writeNumber(entries[i].size);
+                out.put('\t');
+                out.writeHex(entries[i].digest, MD5_DIGEST_SIZE);
+                out.put('\n');
+            }
+        }
+
+        bool bWritten = !ferror(file);
+        return (fclose(file) == 0) && bWritten;
+    }
+
+private:
+    struct tEntry {
+        std::string strPath;
+        unsigned long long size;
+        unsigned char digest[MD5_DIGEST_SIZE];
+    };
+
+    std::vector<tEntry> entries;
+};
+
+#endif
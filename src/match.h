@@ -0,0 +1,242 @@
+/*****************************************************************************/
+/* match.h                                   Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* substring, suffix and case-insensitive matching for the search filters    */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_MATCH_H
+#define STORMEXTRACT_MATCH_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// SSE2 is part of the x86-64 baseline, AVX2 is picked at runtime.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define STORMEXTRACT_MATCH_X86 1
+#include <immintrin.h>
+#endif
+
+// ASCII-only case folding; CASC paths never contain anything else.
+inline char foldCase(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c | 0x20) : c;
+}
+
+/* Scalar implementations
+ *
+ * Used for short haystacks, for the tail of the vector loops and on
+ * platforms without SSE2.
+ */
+inline bool equalsIgnoreCaseScalar(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (foldCase(a[i]) != foldCase(b[i]))
+            return false;
+    }
+    return true;
+}
+
+inline const char *findScalar(const char *hay, size_t n, const char *needle, size_t m) {
+    if (m == 0)
+        return hay;
+
+    const char *end = hay + n;
+    while (size_t(end - hay) >= m) {
+        const char *p = (const char *) memchr(hay, needle[0], size_t(end - hay) - m + 1);
+        if (!p)
+            return NULL;
+        if (memcmp(p + 1, needle + 1, m - 1) == 0)
+            return p;
+        hay = p + 1;
+    }
+    return NULL;
+}
+
+inline const char *findIgnoreCaseScalar(const char *hay, size_t n, const char *needle, size_t m) {
+    if (m == 0)
+        return hay;
+
+    for (size_t i = 0; i + m <= n; ++i) {
+        if (foldCase(hay[i]) == foldCase(needle[0]) && equalsIgnoreCaseScalar(hay + i + 1, needle + 1, m - 1))
+            return hay + i;
+    }
+    return NULL;
+}
+
+#if STORMEXTRACT_MATCH_X86
+/* SSE2 / AVX2 implementations
+ *
+ * Classic "first and last byte" prefilter: compare a whole block of
+ * candidate positions against the first and the last byte of the needle at
+ * once, and only run the full comparison where both match.
+ */
+template <bool IgnoreCase>
+inline __m128i foldBlock128(__m128i v) {
+    if (!IgnoreCase)
+        return v;
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+inline bool equalsIgnoreCaseSSE2(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = foldBlock128<true>(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m128i vb = foldBlock128<true>(_mm_loadu_si128((const __m128i *) (b + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF)
+            return false;
+    }
+    return equalsIgnoreCaseScalar(a + i, b + i, n - i);
+}
+
+template <bool IgnoreCase>
+inline bool equalsMiddle(const char *a, const char *b, size_t n) {
+    return IgnoreCase ? equalsIgnoreCaseSSE2(a, b, n) : (memcmp(a, b, n) == 0);
+}
+
+template <bool IgnoreCase>
+const char *findSSE2(const char *hay, size_t n, const char *needle, size_t m) {
+    if (m == 0)
+        return hay;
+    if (m > n)
+        return NULL;
+
+    const __m128i first = _mm_set1_epi8(IgnoreCase ? foldCase(needle[0]) : needle[0]);
+    const __m128i last = _mm_set1_epi8(IgnoreCase ? foldCase(needle[m - 1]) : needle[m - 1]);
+    const size_t middle = (m > 2) ? m - 2 : 0;
+
+    size_t i = 0;
+    for (; i + m + 15 <= n; i += 16) {
+        __m128i blockFirst = foldBlock128<IgnoreCase>(_mm_loadu_si128((const __m128i *) (hay + i)));
+        __m128i blockLast = foldBlock128<IgnoreCase>(_mm_loadu_si128((const __m128i *) (hay + i + m - 1)));
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first),
+                                                                 _mm_cmpeq_epi8(blockLast, last))));
+        while (mask) {
+            size_t bit = size_t(__builtin_ctz(mask));
+            if (equalsMiddle<IgnoreCase>(hay + i + bit + 1, needle + 1, middle))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return IgnoreCase ? findIgnoreCaseScalar(hay + i, n - i, needle, m)
+                      : findScalar(hay + i, n - i, needle, m);
+}
+
+template <bool IgnoreCase>
+__attribute__((target("avx2")))
+inline __m256i foldBlock256(__m256i v) {
+    if (!IgnoreCase)
+        return v;
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+template <bool IgnoreCase>
+__attribute__((target("avx2")))
+const char *findAVX2(const char *hay, size_t n, const char *needle, size_t m) {
+    if (m == 0)
+        return hay;
+    if (m > n)
+        return NULL;
+
+    const __m256i first = _mm256_set1_epi8(IgnoreCase ? foldCase(needle[0]) : needle[0]);
+    const __m256i last = _mm256_set1_epi8(IgnoreCase ? foldCase(needle[m - 1]) : needle[m - 1]);
+    const size_t middle = (m > 2) ? m - 2 : 0;
+
+    size_t i = 0;
+    for (; i + m + 31 <= n; i += 32) {
+        __m256i blockFirst = foldBlock256<IgnoreCase>(_mm256_loadu_si256((const __m256i *) (hay + i)));
+        __m256i blockLast = foldBlock256<IgnoreCase>(_mm256_loadu_si256((const __m256i *) (hay + i + m - 1)));
+        unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first),
+                                                                       _mm256_cmpeq_epi8(blockLast, last))));
+        while (mask) {
+            size_t bit = size_t(__builtin_ctz(mask));
+            if (equalsMiddle<IgnoreCase>(hay + i + bit + 1, needle + 1, middle))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    // Whatever is left is shorter than one AVX2 block, SSE2 still applies.
+    return findSSE2<IgnoreCase>(hay + i, n - i, needle, m);
+}
+#endif
+
+/* Runtime dispatch
+ *
+ * Resolved once, on first use.  Setting STORMEXTRACT_SIMD=scalar|sse2 in the
+ * environment forces a lower tier, which is handy when comparing them;
+ * path-bench checks every tier against std::string::find().
+ */
+typedef const char *(*tFindFunc)(const char *hay, size_t n, const char *needle, size_t m);
+
+struct tMatchDispatch {
+    const char *szName;
+    tFindFunc find;
+    tFindFunc findIgnoreCase;
+    bool (*equalsIgnoreCase)(const char *a, const char *b, size_t n);
+};
+
+// Every tier this CPU can run, lowest first; returns how many there are
+static const size_t MATCH_TIER_COUNT = 3;
+
+inline size_t matchTiers(tMatchDispatch tiers[MATCH_TIER_COUNT]) {
+    tMatchDispatch scalar = { "scalar", findScalar, findIgnoreCaseScalar, equalsIgnoreCaseScalar };
+    size_t count = 0;
+    tiers[count++] = scalar;
+#if STORMEXTRACT_MATCH_X86
+    tMatchDispatch sse2 = { "sse2", findSSE2<false>, findSSE2<true>, equalsIgnoreCaseSSE2 };
+    tMatchDispatch avx2 = { "avx2", findAVX2<false>, findAVX2<true>, equalsIgnoreCaseSSE2 };
+    tiers[count++] = sse2;
+    if (__builtin_cpu_supports("avx2"))
+        tiers[count++] = avx2;
+#endif
+    return count;
+}
+
+inline tMatchDispatch resolveMatchDispatch() {
+    tMatchDispatch tiers[MATCH_TIER_COUNT];
+    size_t count = matchTiers(tiers);
+
+    const char *szForced = getenv("STORMEXTRACT_SIMD");
+    for (size_t i = 0; szForced && i < count; ++i) {
+        if (strcmp(szForced, tiers[i].szName) == 0)
+            return tiers[i];
+    }
+    return tiers[count - 1];
+}
+
+inline const tMatchDispatch &matchDispatch() {
+    static const tMatchDispatch dispatch = resolveMatchDispatch();
+    return dispatch;
+}
+
+/* Public helpers
+ *
+ * All of them work on (pointer, length) pairs so the callers never need to
+ * build a std::string just to run a comparison.
+ */
+inline const char *findSubstring(const char *hay, size_t n, const char *needle, size_t m) {
+    return matchDispatch().find(hay, n, needle, m);
+}
+
+inline const char *findSubstringIgnoreCase(const char *hay, size_t n, const char *needle, size_t m) {
+    return matchDispatch().findIgnoreCase(hay, n, needle, m);
+}
+
+inline bool equalsIgnoreCase(const char *a, const char *b, size_t n) {
+    return matchDispatch().equalsIgnoreCase(a, b, n);
+}
+
+// Find out if the end of the string matches another string
+inline bool hasSuffix(const char *s, size_t n, const char *suffix, size_t m) {
+    return (n >= m) && (memcmp(s + n - m, suffix, m) == 0);
+}
+
+inline bool hasSuffixIgnoreCase(const char *s, size_t n, const char *suffix, size_t m) {
+    return (n >= m) && equalsIgnoreCase(s + n - m, suffix, m);
+}
+
+#endif
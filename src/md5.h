@@ -0,0 +1,57 @@
+/*****************************************************************************/
+/* md5.h                                     Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* MD5, the hash CASC uses for content and encoding keys, from libtomcrypt   */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_MD5_H
+#define STORMEXTRACT_MD5_H
+
+#include "../CascLib/src/libtomcrypt/src/headers/tomcrypt.h"
+
+#include <string.h>
+
+static const size_t MD5_DIGEST_SIZE = 16;
+
+/* Incremental MD5: update() as often as needed, then final() once.
+ *
+ * The libtomcrypt CascLib bundles (and links into every build) does the
+ * work, this only wraps its hash_state.
+ */
+class tMD5 {
+public:
+    tMD5() {
+        reset();
+    }
+
+    void reset() {
+        md5_init(&state);
+    }
+
+    void update(const void *data, size_t size) {
+        // md5_process() takes an unsigned long, 32 bits on Windows
+        const unsigned char *bytes = (const unsigned char *) data;
+        while (size) {
+            size_t n = (size > 0x40000000) ? 0x40000000 : size;
+            md5_process(&state, bytes, (unsigned long) n);
+            bytes += n;
+            size -= n;
+        }
+    }
+
+    void final(unsigned char digest[MD5_DIGEST_SIZE]) {
+        md5_done(&state, digest);
+        reset();
+    }
+
+    static void hash(const void *data, size_t size, unsigned char digest[MD5_DIGEST_SIZE]) {
+        tMD5 md5;
+        md5.update(data, size);
+        md5.final(digest);
+    }
+
+private:
+    hash_state state;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*****************************************************************************/
+/* memextract.h                              Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* extracting files to memory, handed to a callback instead of written out   */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_MEMEXTRACT_H
+#define STORMEXTRACT_MEMEXTRACT_H
+
+#include "../CascLib/src/CascLib.h"
+#include "bufferpool.h"
+
+#include <errno.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/* One piece of an extracted file.
+ *
+ * data is only valid during the callback: the buffer is reused for the next
+ * chunk and the next file, copy what has to be kept.
+ */
+struct tChunk {
+    const char *szFullPath;
+    unsigned long long fileSize;    // Of the whole file
+    unsigned long long offset;      // Of data in the file
+    const char *data;
+    size_t size;
+    bool bLast;                     // No more chunks for this file
+};
+
+// Return false to stop the extraction
+typedef std::function<bool (const tChunk &chunk)> tChunkCallback;
+
+/* Extracts files of an open storage to a callback, for programs embedding
+ * storm-extract that want the bytes rather than files (an indexer parsing
+ * the XML, say).
+ *
+ * A file of at most WHOLE bytes comes in a single chunk, so it can be
+ * parsed in place; larger ones come in chunks of CHUNK bytes.  The buffer
+ * comes from the shared tBufferPool and serves every file; it is only
+ * swapped for a larger one when a file needs more.
+ *
+ *     tMemoryExtractor extractor(hStorage);
+ *     extractor.extract("mods/core.stormmod/base.stormdata/GameData.xml", [&](const tChunk &chunk) {
+ *         parser.feed(chunk.data, chunk.size);
+ *         return true;
+ *     });
+ *
+ * One extractor per thread; CascLib handles may be shared.
+ */
+class tMemoryExtractor {
+public:
+    static const size_t DEFAULT_WHOLE = 0x400000;
+    static const size_t DEFAULT_CHUNK = 0x100000;
+
+    /* @param nWhole    Files up to this size come in one chunk
+     * @param nChunk    Size of the chunks of larger files
+     */
+    explicit tMemoryExtractor(HANDLE hStorage, size_t nWhole = DEFAULT_WHOLE, size_t nChunk = DEFAULT_CHUNK)
+        : hStorage(hStorage), nWhole(nWhole), nChunk(nChunk ? nChunk : DEFAULT_CHUNK) {
+    }
+
+    /* Hand a file to the callback, in one or more chunks.  An empty file
+     * still gets one (empty) chunk.
+     *
+     * @return false if the file could not be opened or read, with errno
+     *         set, or if the callback stopped it (errno is ECANCELED)
+     */
+    bool extract(const char *szFullPath, const tChunkCallback &callback) {
+        HANDLE hFile;
+        if (!CascOpenFile(hStorage, szFullPath, CASC_LOCALE_ALL, 0, &hFile))
+            return false;
+
+        DWORD dwHigh = 0;
+        DWORD dwLow = CascGetFileSize(hFile, &dwHigh);
+        if (dwLow == CASC_INVALID_SIZE) {
+            int error = errno;
+            CascCloseFile(hFile);
+            errno = error;
+            return false;
+        }
+        unsigned long long fileSize = ((unsigned long long) dwHigh << 32) | dwLow;
+
+        size_t nBuffer = (fileSize <= nWhole) ? size_t(fileSize) : nChunk;
+        if (buffer.size() < nBuffer) {
+            buffer.release();
+            buffer = tBufferPool::shared().acquire(nBuffer);
+            if (!buffer) {
+                CascCloseFile(hFile);
+                errno = ENOMEM;
+                return false;
+            }
+        }
+
+        tChunk chunk = { szFullPath, fileSize, 0, buffer.data(), 0, false };
+        bool bResult = true;
+        do {
+            // Fill the buffer, so that only the last chunk is short
+            chunk.size = 0;
+            while (chunk.size < nBuffer) {
+                DWORD read = 0;
+                if (!CascReadFile(hFile, buffer.data() + chunk.size, DWORD(nBuffer - chunk.size), &read)) {
+                    bResult = false;
+                    break;
+                }
+                if (read == 0)
+                    break;
+                chunk.size += read;
+            }
+            if (!bResult)
+                break;
+
+            chunk.bLast = (chunk.size < nBuffer) || (chunk.offset + chunk.size >= fileSize);
+            if (!callback(chunk)) {
+                errno = ECANCELED;
+                bResult = false;
+                break;
+            }
+            chunk.offset += chunk.size;
+        } while (!chunk.bLast);
+
+        int error = errno;
+        CascCloseFile(hFile);
+        errno = error;
+        return bResult;
+    }
+
+    /* Extract several files, in the given order.
+     *
+     * @return How many were handed over completely; it stops at the first
+     *         file the callback stops, files that cannot be read are skipped
+     */
+    size_t extract(const std::vector<std::string> &paths, const tChunkCallback &callback) {
+        size_t nDone = 0;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (extract(paths[i].c_str(), callback))
+                ++nDone;
+            else if (errno == ECANCELED)
+                break;
+        }
+        return nDone;
+    }
+
+private:
+    HANDLE hStorage;
+    size_t nWhole;
+    size_t nChunk;
+    tBuffer buffer;
+};
+
+#endif
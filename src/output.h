@@ -0,0 +1,188 @@
+/*****************************************************************************/
+/* output.h                                  Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* buffered console output and a rate-limited progress line                  */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_OUTPUT_H
+#define STORMEXTRACT_OUTPUT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+/* Collects output in a large buffer and writes it out in big blocks.
+ *
+ * Nothing is flushed per line: call flush() before anything that has to be
+ * seen right away (a progress redraw, an error on stderr, exiting).
+ */
+class tOutput {
+public:
+    explicit tOutput(FILE *stream) : stream(stream), used(0) {
+    }
+
+    ~tOutput() {
+        flush();
+    }
+
+    void write(const char *data, size_t size) {
+        if (used + size > sizeof(buffer)) {
+            flush();
+            if (size > sizeof(buffer)) {
+                fwrite(data, 1, size, stream);
+                return;
+            }
+        }
+        memcpy(buffer + used, data, size);
+        used += size;
+    }
+
+    void write(const char *sz) {
+        write(sz, strlen(sz));
+    }
+
+    void write(const std::string &str) {
+        write(str.data(), str.size());
+    }
+
+    void put(char c) {
+        if (used == sizeof(buffer))
+            flush();
+        buffer[used++] = c;
+    }
+
+    void writeNumber(unsigned long long value) {
+        char digits[24];
+        size_t n = sizeof(digits);
+        do {
+            digits[--n] = char('0' + value % 10);
+            value /= 10;
+        } while (value);
+        write(digits + n, sizeof(digits) - n);
+    }
+
+    // Lowercase hex, two digits per byte
+    void writeHex(const unsigned char *data, size_t size) {
+        static const char digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < size; ++i) {
+            put(digits[data[i] >> 4]);
+            put(digits[data[i] & 15]);
+        }
+    }
+
+    // A quoted JSON string.  Bytes above 0x7f are copied as they are, paths
+    // in the storage are UTF-8.
+    void writeJsonString(const char *data, size_t size) {
+        put('"');
+        size_t start = 0;
+        for (size_t i = 0; i < size; ++i) {
+            unsigned char c = (unsigned char) data[i];
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+
+            write(data + start, i - start);
+            start = i + 1;
+            put('\\');
+            switch (c) {
+                case '"':  put('"');  break;
+                case '\\': put('\\'); break;
+                case '\n': put('n');  break;
+                case '\r': put('r');  break;
+                case '\t': put('t');  break;
+                default:
+                    write("u00", 3);
+                    writeHex(&c, 1);
+                    break;
+            }
+        }
+        write(data + start, size - start);
+        put('"');
+    }
+
+    void flush() {
+        if (used) {
+            fwrite(buffer, 1, used, stream);
+            used = 0;
+        }
+        fflush(stream);
+    }
+
+    // Whether writing to the stream failed at some point
+    bool failed() const {
+        return ferror(stream) != 0;
+    }
+
+    bool isTerminal() const {
+        return isatty(fileno(stream)) != 0;
+    }
+
+private:
+    FILE *stream;
+    size_t used;
+    char buffer[0x10000];
+};
+
+/* A single status line redrawn in place, at most every 100 ms.
+ *
+ * Only drawn when the output is a terminal; in a pipe or a log file it would
+ * be nothing but escape codes.
+ */
+class tProgress {
+public:
+    explicit tProgress(tOutput &output)
+        : output(output), bEnabled(output.isTerminal()), bDrawn(false) {
+    }
+
+    void disable() {
+        bEnabled = false;
+    }
+
+    /* Redraw the line, unless it was drawn less than 100 ms ago.
+     *
+     * @param done      Items processed so far
+     * @param total     Items expected, 0 if not known yet
+     * @param szLabel   What is being worked on, may be NULL
+     */
+    void update(size_t done, size_t total, const char *szLabel) {
+        if (!bEnabled)
+            return;
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (bDrawn && now - lastDraw < std::chrono::milliseconds(100))
+            return;
+        lastDraw = now;
+        bDrawn = true;
+
+        char line[64];
+        if (total)
+            snprintf(line, sizeof(line), "%c[2K\r  %6d%% (%zu/%zu) ", 27, int(done * 100 / total), done, total);
+        else
+            snprintf(line, sizeof(line), "%c[2K\r  %7zu ", 27, done);
+        output.write(line);
+        if (szLabel)
+            output.write(szLabel);
+        output.flush();
+    }
+
+    // Erase the line, so whatever comes next starts clean
+    void finish() {
+        if (bEnabled && bDrawn) {
+            char line[8];
+            snprintf(line, sizeof(line), "%c[2K\r", 27);
+            output.write(line);
+            output.flush();
+        }
+        bDrawn = false;
+    }
+
+private:
+    tOutput &output;
+    bool bEnabled;
+    bool bDrawn;
+    std::chrono::steady_clock::time_point lastDraw;
+};
+
+#endif
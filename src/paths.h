@@ -0,0 +1,174 @@
+/*****************************************************************************/
+/* paths.h                                   Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* building destination paths for extracted files                            */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_PATHS_H
+#define STORMEXTRACT_PATHS_H
+
+#include "match.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/* Append a storage path to a destination path.
+ *
+ * Backslashes become forward slashes and, when asked, the path is folded to
+ * lowercase, all in a single pass over the source.  The caller owns the
+ * buffer and is expected to reuse it between files so its capacity sticks.
+ */
+inline void appendDestPath(std::string &strDest, const char *szPath, size_t nPath, bool bLowerCase) {
+    size_t start = strDest.size();
+    strDest.resize(start + nPath);
+
+    char *out = &strDest[start];
+    for (size_t i = 0; i < nPath; ++i) {
+        char c = szPath[i];
+        if (c == '\\')
+            c = '/';
+        else if (bLowerCase)
+            c = foldCase(c);
+        out[i] = c;
+    }
+}
+
+/* Destination paths for extraction, and the directories they need.
+ *
+ * build() writes root + path into one buffer in a single pass and notes
+ * where every parent directory ends as it goes, so the parents are prefixes
+ * of that buffer rather than strings of their own.  createDirectories()
+ * remembers what it made or found, so a file whose directory was already
+ * seen costs one lookup and no system call, and a file next to the previous
+ * one costs a comparison.
+ *
+ * Buffers and cache live as long as the object; nothing allocates once
+ * they have grown, except remembering a new directory.
+ */
+class tDestPath {
+public:
+    tDestPath() : nRoot(0), nRootSeparators(0) {
+    }
+
+    /* Start over below another destination, which should end with '/'.
+     *
+     * The directory cache is dropped too: directories may have been removed
+     * since the last extraction.
+     */
+    void setRoot(const std::string &strRoot) {
+        strPath = strRoot;
+        separators.clear();
+        known.clear();
+        strLastParent.clear();
+        for (size_t i = 0; i < strPath.size(); ++i) {
+            if (strPath[i] == '/')
+                separators.push_back(i);
+        }
+        nRoot = strPath.size();
+        nRootSeparators = separators.size();
+    }
+
+    // Root + szPath, normalized the way appendDestPath() does it
+    const std::string &build(const char *szPath, size_t nPath, bool bLowerCase) {
+        strPath.resize(nRoot);
+        separators.resize(nRootSeparators);
+        append(szPath, nPath, bLowerCase);
+        return strPath;
+    }
+
+    const std::string &path() const {
+        return strPath;
+    }
+
+    // path() without the root
+    const char *relativePath() const {
+        return strPath.c_str() + nRoot;
+    }
+
+    // Parent directories, outermost first; directory(i) is that many bytes of path()
+    size_t directoryCount() const {
+        return separators.size();
+    }
+
+    size_t directory(size_t i) const {
+        return separators[i];
+    }
+
+    /* Create the parent directories of the last path built.
+     *
+     * Walks up to the deepest directory already known, then creates the
+     * ones below it, outermost first.
+     *
+     * @return false if one could not be created, errno says why
+     */
+    bool createDirectories() {
+        if (separators.empty())
+            return true;
+
+        // Files come grouped by directory when sorted, that needs no hashing
+        size_t nParent = separators.back();
+        if (strLastParent.size() == nParent && memcmp(strLastParent.data(), strPath.data(), nParent) == 0)
+            return true;
+
+        size_t first = separators.size();
+        while (first > 0 && !isKnown(separators[first - 1]))
+            --first;
+
+        for (size_t i = first; i < separators.size(); ++i) {
+            size_t n = separators[i];
+            if (n == 0)
+                continue;   // The root of an absolute path
+
+            // Cut the path at the separator instead of copying the prefix
+            strPath[n] = 0;
+            int result = mkdir(strPath.c_str(), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+            int error = errno;
+            strPath[n] = '/';
+            if (result != 0 && error != EEXIST) {
+                errno = error;
+                return false;
+            }
+            known.insert(std::string(strPath, 0, n));
+        }
+        strLastParent.assign(strPath, 0, nParent);
+        return true;
+    }
+
+private:
+    std::string strPath;
+    std::vector<size_t> separators;     // Offset of the '/' ending each parent
+    size_t nRoot;
+    size_t nRootSeparators;
+    std::unordered_set<std::string> known;
+    std::string strKey;                 // Lookup buffer, so lookups don't allocate
+    std::string strLastParent;          // Where the previous file went
+
+    // appendDestPath(), noting the separators in the same pass
+    void append(const char *szPath, size_t nPath, bool bLowerCase) {
+        size_t start = strPath.size();
+        strPath.resize(start + nPath);
+
+        char *out = &strPath[start];
+        for (size_t i = 0; i < nPath; ++i) {
+            char c = szPath[i];
+            if (c == '\\' || c == '/') {
+                c = '/';
+                separators.push_back(start + i);
+            } else if (bLowerCase) {
+                c = foldCase(c);
+            }
+            out[i] = c;
+        }
+    }
+
+    bool isKnown(size_t n) {
+        strKey.assign(strPath, 0, n);
+        return known.count(strKey) != 0;
+    }
+};
+
+#endif
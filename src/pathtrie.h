@@ -0,0 +1,190 @@
+/*****************************************************************************/
+/* pathtrie.h                                Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* directory tree built while searching, for listings and per-directory sums */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_PATHTRIE_H
+#define STORMEXTRACT_PATHTRIE_H
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/* One node per directory, children chained through sibling indices.
+ *
+ * Component names live back to back in a single string, so adding a file
+ * from a directory that is already known allocates nothing.  Files arrive in
+ * runs from the same directory, so the chain of nodes for the previous
+ * directory is kept and only the components that differ are looked up.
+ */
+class tPathTrie {
+public:
+    struct tNode {
+        size_t nameOffset;
+        size_t nameLength;
+        size_t parent;
+        size_t firstChild;
+        size_t nextSibling;
+        unsigned long long files;       // Directly in this directory
+        unsigned long long bytes;
+        unsigned long long totalFiles;  // Including all subdirectories
+        unsigned long long totalBytes;
+    };
+
+    static const size_t NONE = ~size_t(0);
+
+    tPathTrie() {
+        clear();
+    }
+
+    void clear() {
+        tNode root = { 0, 0, NONE, NONE, NONE, 0, 0, 0, 0 };
+        nodes.assign(1, root);
+        strNames.clear();
+        strLastDir.clear();
+        lastChain.clear();
+        lastEnds.clear();
+        summed = false;
+    }
+
+    size_t size() const {
+        return nodes.size() - 1;
+    }
+
+    const tNode &root() const {
+        return nodes[0];
+    }
+
+    /* Record a file.
+     *
+     * @param szFullPath    Full path of the file inside the storage
+     * @param nDirectory    Length of the directory part, separator included
+     * @param nFileSize     Size of the file, in bytes
+     */
+    void addFile(const char *szFullPath, size_t nDirectory, unsigned long long nFileSize) {
+        while (nDirectory > 0 && isSeparator(szFullPath[nDirectory - 1]))
+            --nDirectory;
+
+        // Reuse the leading components shared with the previous directory
+        size_t depth = 0, start = 0;
+        while (depth < lastEnds.size()) {
+            size_t end = lastEnds[depth];
+            if (end > nDirectory || (end < nDirectory && !isSeparator(szFullPath[end])) ||
+                memcmp(szFullPath + start, strLastDir.data() + start, end - start) != 0)
+                break;
+            start = end + 1;
+            ++depth;
+        }
+
+        lastChain.resize(depth);
+        lastEnds.resize(depth);
+        strLastDir.assign(szFullPath, nDirectory);
+
+        size_t node = depth ? lastChain[depth - 1] : 0;
+        while (start < nDirectory) {
+            size_t end = start;
+            while (end < nDirectory && !isSeparator(szFullPath[end]))
+                ++end;
+            if (end > start) {
+                node = child(node, szFullPath + start, end - start);
+                lastChain.push_back(node);
+                lastEnds.push_back(end);
+            }
+            start = end + 1;
+        }
+
+        nodes[node].files++;
+        nodes[node].bytes += nFileSize;
+        summed = false;
+    }
+
+    /* Walk every directory in sorted order, parents before their children.
+     *
+     * The visitor is called as visitor(strPath, node) with the path of the
+     * directory, without a trailing separator.
+     */
+    template <typename Visitor>
+    void visit(Visitor &visitor) {
+        sum();
+        std::string strPath;
+        visitChildren(0, strPath, visitor);
+    }
+
+private:
+    std::vector<tNode> nodes;
+    std::string strNames;
+    std::string strLastDir;
+    std::vector<size_t> lastChain;
+    std::vector<size_t> lastEnds;
+    bool summed;
+
+    static bool isSeparator(char c) {
+        return c == '/' || c == '\\';
+    }
+
+    size_t child(size_t parent, const char *szName, size_t nName) {
+        for (size_t i = nodes[parent].firstChild; i != NONE; i = nodes[i].nextSibling) {
+            if (nodes[i].nameLength == nName && memcmp(strNames.data() + nodes[i].nameOffset, szName, nName) == 0)
+                return i;
+        }
+
+        tNode node = { strNames.size(), nName, parent, NONE, nodes[parent].firstChild, 0, 0, 0, 0 };
+        strNames.append(szName, nName);
+        nodes[parent].firstChild = nodes.size();
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+
+    // Children are always created after their parent, so a single backwards
+    // pass carries every total up to the root.
+    void sum() {
+        if (summed)
+            return;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            nodes[i].totalFiles = nodes[i].files;
+            nodes[i].totalBytes = nodes[i].bytes;
+        }
+        for (size_t i = nodes.size() - 1; i > 0; --i) {
+            nodes[nodes[i].parent].totalFiles += nodes[i].totalFiles;
+            nodes[nodes[i].parent].totalBytes += nodes[i].totalBytes;
+        }
+        summed = true;
+    }
+
+    struct tNameLess {
+        const tPathTrie *trie;
+        bool operator()(size_t a, size_t b) const {
+            const tNode &na = trie->nodes[a], &nb = trie->nodes[b];
+            int cmp = memcmp(trie->strNames.data() + na.nameOffset, trie->strNames.data() + nb.nameOffset,
+                             std::min(na.nameLength, nb.nameLength));
+            return cmp ? cmp < 0 : na.nameLength < nb.nameLength;
+        }
+    };
+
+    template <typename Visitor>
+    void visitChildren(size_t parent, std::string &strPath, Visitor &visitor) {
+        std::vector<size_t> children;
+        for (size_t i = nodes[parent].firstChild; i != NONE; i = nodes[i].nextSibling)
+            children.push_back(i);
+
+        tNameLess less = { this };
+        std::sort(children.begin(), children.end(), less);
+
+        size_t length = strPath.size();
+        for (size_t i = 0; i < children.size(); ++i) {
+            const tNode &node = nodes[children[i]];
+            if (length)
+                strPath += '/';
+            strPath.append(strNames, node.nameOffset, node.nameLength);
+
+            visitor(strPath, node);
+            visitChildren(children[i], strPath, visitor);
+            strPath.resize(length);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*****************************************************************************/
+/* pipeoutput.h                              Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* streaming large blocks to a descriptor, with vmsplice() into pipes        */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_PIPEOUTPUT_H
+#define STORMEXTRACT_PIPEOUTPUT_H
+
+#include "bufferpool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/* Page-aligned buffers, filled by the caller and written to a descriptor.
+ *
+ * When the descriptor is a pipe (Linux only), a full buffer is handed over
+ * with vmsplice(): the pipe references its pages instead of copying them,
+ * and the reader copies them once, straight out of our memory.  The pages
+ * must then stay untouched until the reader is done with them.  The pipe is
+ * sized to one buffer, so it cannot hold more than one buffer's worth; once
+ * the next full buffer went in, the one before it was read.  Three buffers
+ * are cycled for a margin, which is why every buffer but the last has to be
+ * filled completely.  (A reader that splice()s the pages on instead of
+ * reading them would hold on to them longer; anything reading its stdin
+ * with read() does not.)
+ *
+ * Nothing says the reader is done when we are, so buffers that may have been
+ * spliced never go back to the shared tBufferPool, whose next borrower would
+ * write over pages still in the pipe.  They are mapped for this output alone
+ * and unmapped when it goes away: the pipe keeps its own references to the
+ * pages, and no one can write to them any more.
+ *
+ * Anything else (a file, a terminal) gets plain write() calls from buffers
+ * of the pool.
+ */
+class tPipeOutput {
+public:
+    static const size_t BUFFER_SIZE = 0x100000;
+    static const size_t BUFFER_COUNT = 3;
+
+    explicit tPipeOutput(int fd) : fd(fd), nSize(BUFFER_SIZE), current(0), bSplicing(false) {
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode)) {
+            // Unprivileged processes may be held to less than a megabyte
+            int nPipeSize = fcntl(fd, F_SETPIPE_SZ, int(BUFFER_SIZE));
+            if (nPipeSize < 0)
+                nPipeSize = fcntl(fd, F_GETPIPE_SZ);
+            if (nPipeSize > 0) {
+                nSize = size_t(nPipeSize);
+                bSplicing = true;
+            }
+        }
+#endif
+
+        for (size_t i = 0; i < BUFFER_COUNT; ++i) {
+            spliced[i] = NULL;
+#ifdef __linux__
+            if (bSplicing) {
+                void *pages = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                spliced[i] = (pages == MAP_FAILED) ? NULL : (char *) pages;
+                memory[i] = spliced[i];
+                continue;
+            }
+#endif
+            buffers[i] = tBufferPool::shared().acquire(nSize);
+            memory[i] = buffers[i].data();
+        }
+    }
+
+    ~tPipeOutput() {
+#ifdef __linux__
+        for (size_t i = 0; i < BUFFER_COUNT; ++i) {
+            if (spliced[i])
+                munmap(spliced[i], nSize);
+        }
+#endif
+    }
+
+    // False if the buffers could not be allocated
+    bool isOpen() const {
+        for (size_t i = 0; i < BUFFER_COUNT; ++i) {
+            if (!memory[i])
+                return false;
+        }
+        return true;
+    }
+
+    bool isSplicing() const {
+        return bSplicing;
+    }
+
+    // The buffer to fill next, capacity() bytes: all of them unless it is the last
+    char *buffer() {
+        return memory[current];
+    }
+
+    size_t capacity() const {
+        return nSize;
+    }
+
+    /* Send the first SIZE bytes of buffer(), then move on to the next buffer.
+     *
+     * @return false with errno set if they could not all be written
+     */
+    bool write(size_t size) {
+        const char *data = memory[current];
+        current = (current + 1) % BUFFER_COUNT;
+
+        while (size) {
+            ssize_t written;
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+            if (bSplicing) {
+                struct iovec vector = { const_cast<char *>(data), size };
+                written = vmsplice(fd, &vector, 1, 0);
+                if (written < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    bSplicing = false;
+                    continue;
+                }
+            } else
+#endif
+            written = ::write(fd, data, size);
+
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            size -= size_t(written);
+        }
+        return true;
+    }
+
+private:
+    int fd;
+    size_t nSize;                   // Used of each buffer, they may be larger
+    tBuffer buffers[BUFFER_COUNT];  // When not splicing
+    char *spliced[BUFFER_COUNT];    // When splicing, mapped for this output only
+    char *memory[BUFFER_COUNT];     // Either of them
+    size_t current;
+    bool bSplicing;
+
+    tPipeOutput(const tPipeOutput &);
+    tPipeOutput &operator=(const tPipeOutput &);
+};
+
+#endif
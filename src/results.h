@@ -0,0 +1,173 @@
+/*****************************************************************************/
+/* results.h                                 Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* search results packed into one contiguous path heap                       */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_RESULTS_H
+#define STORMEXTRACT_RESULTS_H
+
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A view into memory owned by someone else, NOT necessarily terminated.
+struct tStringRef {
+    const char *data;
+    size_t size;
+
+    std::string str() const {
+        return std::string(data, size);
+    }
+};
+
+// Size of a content key, the MD5 of the decompressed file
+static const size_t CONTENT_KEY_SIZE = 16;
+
+/* A single match, handed to a tSearchVisitor while the search runs.
+ *
+ * The strings point into the enumeration buffers: both are NUL terminated
+ * but only valid for the duration of the call, and so is the key.
+ */
+struct tSearchMatch {
+    const char *szFullPath;
+    size_t nFullPath;
+    const char *szPlainName;
+    size_t nPlainName;
+    unsigned long long fileSize;
+    const unsigned char *contentKey;    // CONTENT_KEY_SIZE bytes, all zero if unknown
+    unsigned int localeFlags;           // CASC_LOCALE_* the file exists for
+};
+
+// CascLib leaves the key zeroed when the root file does not give one
+inline bool hasContentKey(const unsigned char *contentKey) {
+    for (size_t i = 0; i < CONTENT_KEY_SIZE; ++i) {
+        if (contentKey[i])
+            return true;
+    }
+    return false;
+}
+
+// Return false to stop the search early
+typedef std::function<bool (const tSearchMatch &match)> tSearchVisitor;
+
+/* Search results
+ *
+ * Every path is appended, NUL terminated, to a single heap, and each entry
+ * only stores where its path starts, how long it is and where the plain name
+ * begins.  A full listing costs two growing buffers instead of two strings
+ * per file, and iterating it walks memory in order.  Sorting only moves the
+ * fixed-size entries, the heap is never touched again once written.
+ */
+class tSearchResults {
+public:
+    struct tEntry {
+        size_t pathOffset;              // Offset of the full path in the heap
+        unsigned int pathLength;
+        unsigned int plainOffset;       // Offset of the plain name in the path
+        unsigned long long fileSize;
+        unsigned char contentKey[CONTENT_KEY_SIZE];
+        unsigned int localeFlags;
+    };
+
+    // Storage paths are mostly below this, NUL included; a few are longer
+    static const size_t TYPICAL_PATH = 128;
+
+    /* Room for nEntries paths taking nHeapBytes, NULs included, or paths of
+     * TYPICAL_PATH bytes if 0.  Only an exact nHeapBytes keeps the heap from
+     * ever being copied; untouched capacity is only address space, so a
+     * generous guess costs little.
+     */
+    void reserve(size_t nEntries, size_t nHeapBytes = 0) {
+        entries.reserve(nEntries);
+        heap.reserve(nHeapBytes ? nHeapBytes : nEntries * TYPICAL_PATH);
+    }
+
+    void add(const tSearchMatch &match) {
+        add(match.szFullPath, match.nFullPath, match.nFullPath - match.nPlainName, match.fileSize, match.contentKey,
+            match.localeFlags);
+    }
+
+    void add(const char *szFullPath, size_t nFullPath, size_t nPlainOffset, unsigned long long nFileSize,
+             const unsigned char *contentKey, unsigned int nLocaleFlags) {
+        tEntry entry = { heap.size(), (unsigned int) nFullPath, (unsigned int) nPlainOffset, nFileSize, { 0 },
+                         nLocaleFlags };
+        memcpy(entry.contentKey, contentKey, CONTENT_KEY_SIZE);
+        heap.insert(heap.end(), szFullPath, szFullPath + nFullPath);
+        heap.push_back(0);
+        entries.push_back(entry);
+    }
+
+    void clear() {
+        heap.clear();
+        entries.clear();
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    const tEntry &operator[](size_t i) const {
+        return entries[i];
+    }
+
+    // NUL terminated, so it can go straight to CascOpenFile()
+    const char *c_str(const tEntry &entry) const {
+        return &heap[entry.pathOffset];
+    }
+
+    tStringRef path(const tEntry &entry) const {
+        tStringRef ref = { &heap[entry.pathOffset], entry.pathLength };
+        return ref;
+    }
+
+    // The entry seen as a match, for handing it to a tSearchVisitor
+    tSearchMatch match(const tEntry &entry) const {
+        tSearchMatch ret = { c_str(entry), entry.pathLength, c_str(entry) + entry.plainOffset,
+                             entry.pathLength - entry.plainOffset, entry.fileSize, entry.contentKey,
+                             entry.localeFlags };
+        return ret;
+    }
+
+    tStringRef plainName(const tEntry &entry) const {
+        tStringRef ref = { &heap[entry.pathOffset + entry.plainOffset], entry.pathLength - entry.plainOffset };
+        return ref;
+    }
+
+    // Comparators see the entries and the results, to reach the paths
+    template <typename Compare>
+    void sort(Compare compare) {
+        tBound<Compare> bound = { this, compare };
+        std::sort(entries.begin(), entries.end(), bound);
+    }
+
+    // Byte-wise comparison of two full paths
+    int comparePaths(const tEntry &a, const tEntry &b) const {
+        int cmp = memcmp(&heap[a.pathOffset], &heap[b.pathOffset], std::min(a.pathLength, b.pathLength));
+        if (cmp)
+            return cmp;
+        return (a.pathLength < b.pathLength) ? -1 : (a.pathLength > b.pathLength);
+    }
+
+private:
+    std::vector<char> heap;
+    std::vector<tEntry> entries;
+
+    template <typename Compare>
+    struct tBound {
+        const tSearchResults *results;
+        Compare compare;
+        bool operator()(const tEntry &a, const tEntry &b) const {
+            return compare(*results, a, b);
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,262 @@
+/*****************************************************************************/
+/* stats.h                                   Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* timings and counters for --stats                                          */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_STATS_H
+#define STORMEXTRACT_STATS_H
+
+#include "bufferpool.h"
+#include "output.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/* What a run did and how long each part of it took.
+ *
+ * The counters are always kept, they cost an increment.  Clocks are only
+ * read when bEnabled is set.
+ */
+class tStats {
+public:
+    struct tPhase {
+        const char *szName;
+        double wall;                // Seconds
+        double cpu;                 // Seconds, all threads of the process
+    };
+
+    struct tFileStat {
+        std::string strPath;
+        unsigned long long bytes;
+        double seconds;
+    };
+
+    static const size_t TOP_FILES = 5;
+
+    bool bEnabled;
+    unsigned long long entriesSeen;     // File table entries looked at
+    unsigned long long filesFound;
+    unsigned long long filesExtracted;
+    unsigned long long bytesExtracted;
+    unsigned long long openFailures;    // In the storage
+    unsigned long long createFailures;  // Of the destination file
+    unsigned long long readFailures;
+    unsigned long long writeFailures;
+    double extractSeconds;              // Summed over the files
+    double searchSeconds;               // Of the phases that enumerate
+
+    std::vector<tPhase> phases;
+    std::vector<tFileStat> largest;     // Biggest first
+    std::vector<tFileStat> slowest;     // Slowest first
+
+    tStats()
+        : bEnabled(false), entriesSeen(0), filesFound(0), filesExtracted(0), bytesExtracted(0),
+          openFailures(0), createFailures(0), readFailures(0), writeFailures(0),
+          extractSeconds(0), searchSeconds(0), phaseWall(0), phaseCpu(0), phaseExtract(0), szPhase(NULL) {
+    }
+
+    static double wallClock() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    static double cpuClock() {
+        struct timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    // Phases do not nest, starting one ends the current one
+    void beginPhase(const char *szName) {
+        if (!bEnabled)
+            return;
+        endPhase();
+        szPhase = szName;
+        phaseExtract = extractSeconds;
+        phaseWall = wallClock();
+        phaseCpu = cpuClock();
+    }
+
+    void endPhase() {
+        if (!bEnabled || !szPhase)
+            return;
+        tPhase phase = { szPhase, wallClock() - phaseWall, cpuClock() - phaseCpu };
+        phases.push_back(phase);
+        szPhase = NULL;
+    }
+
+    // A phase that walks the file table, for the enumeration rate.  Files
+    // extracted while it ran do not count as enumerating.
+    void endSearchPhase() {
+        size_t count = phases.size();
+        endPhase();
+        if (phases.size() > count)
+            searchSeconds += phases.back().wall - (extractSeconds - phaseExtract);
+    }
+
+    // A file was extracted, in that many seconds
+    void addFile(const char *szFullPath, unsigned long long bytes, double seconds) {
+        filesExtracted++;
+        bytesExtracted += bytes;
+        extractSeconds += seconds;
+        if (!bEnabled)
+            return;
+
+        insertTop(largest, szFullPath, bytes, seconds, &tFileStat::bytes);
+        insertTop(slowest, szFullPath, bytes, seconds, &tFileStat::seconds);
+    }
+
+    unsigned long long failures() const {
+        return openFailures + createFailures + readFailures + writeFailures;
+    }
+
+    void print(FILE *stream) const {
+        fprintf(stream, "Statistics:\n");
+        for (size_t i = 0; i < phases.size(); ++i)
+            fprintf(stream, "  %-18s %10.3fs wall %10.3fs cpu\n", phases[i].szName, phases[i].wall, phases[i].cpu);
+
+        fprintf(stream, "  %llu entries enumerated (%.0f/s)\n", entriesSeen, rate(double(entriesSeen), searchSeconds));
+        fprintf(stream, "  %llu files found\n", filesFound);
+        fprintf(stream, "  %llu files extracted, %llu bytes (%.1f files/s, %.1f MB/s)\n", filesExtracted,
+                bytesExtracted, rate(double(filesExtracted), extractSeconds),
+                rate(bytesExtracted / 1048576.0, extractSeconds));
+        fprintf(stream, "  %llu failures: %llu not found, %llu not created, %llu read errors, %llu write errors\n",
+                failures(), openFailures, createFailures, readFailures, writeFailures);
+
+        tBufferPool::tCounters pool = tBufferPool::shared().counters();
+        fprintf(stream, "  %llu buffers borrowed, %llu allocated, at most %zu in use (%.1f MB)\n",
+                pool.acquired, pool.allocated, pool.peakBuffersInUse, pool.peakBytesInUse / 1048576.0);
+
+        if (!largest.empty()) {
+            fprintf(stream, "  Largest files:\n");
+            for (size_t i = 0; i < largest.size(); ++i)
+                fprintf(stream, "    %14llu  %s\n", largest[i].bytes, largest[i].strPath.c_str());
+        }
+        if (!slowest.empty()) {
+            fprintf(stream, "  Slowest files:\n");
+            for (size_t i = 0; i < slowest.size(); ++i)
+                fprintf(stream, "    %13.3fs  %s\n", slowest[i].seconds, slowest[i].strPath.c_str());
+        }
+    }
+
+    /* Write the same report as a JSON object.
+     *
+     * @return false if the file could not be written
+     */
+    bool writeJson(const char *szFileName) const {
+        FILE *file = fopen(szFileName, "w");
+        if (!file)
+            return false;
+
+        {
+            tOutput out(file);
+            char number[64];
+
+            out.write("{\"phases\":[");
+            for (size_t i = 0; i < phases.size(); ++i) {
+                if (i)
+                    out.put(',');
+                out.write("{\"name\":");
+                out.writeJsonString(phases[i].szName, strlen(phases[i].szName));
+                snprintf(number, sizeof(number), ",\"wall\":%.6f,\"cpu\":%.6f}", phases[i].wall, phases[i].cpu);
+                out.write(number);
+            }
+            out.write("]");
+
+            writeField(out, "entriesEnumerated", entriesSeen);
+            writeField(out, "filesFound", filesFound);
+            writeField(out, "filesExtracted", filesExtracted);
+            writeField(out, "bytesExtracted", bytesExtracted);
+            snprintf(number, sizeof(number), ",\"entriesPerSecond\":%.1f", rate(double(entriesSeen), searchSeconds));
+            out.write(number);
+            snprintf(number, sizeof(number), ",\"filesPerSecond\":%.1f", rate(double(filesExtracted), extractSeconds));
+            out.write(number);
+            snprintf(number, sizeof(number), ",\"bytesPerSecond\":%.0f", rate(double(bytesExtracted), extractSeconds));
+            out.write(number);
+
+            out.write(",\"failures\":{\"total\":");
+            out.writeNumber(failures());
+            writeField(out, "notFound", openFailures);
+            writeField(out, "notCreated", createFailures);
+            writeField(out, "readErrors", readFailures);
+            writeField(out, "writeErrors", writeFailures);
+            out.put('}');
+
+            tBufferPool::tCounters pool = tBufferPool::shared().counters();
+            out.write(",\"buffers\":{\"borrowed\":");
+            out.writeNumber(pool.acquired);
+            writeField(out, "allocated", pool.allocated);
+            writeField(out, "peakInUse", pool.peakBuffersInUse);
+            writeField(out, "peakBytesInUse", pool.peakBytesInUse);
+            out.put('}');
+
+            writeFiles(out, "largest", largest);
+            writeFiles(out, "slowest", slowest);
+            out.write("}\n");
+        }
+
+        bool bWritten = !ferror(file);
+        return (fclose(file) == 0) && bWritten;
+    }
+
+private:
+    double phaseWall;
+    double phaseCpu;
+    double phaseExtract;
+    const char *szPhase;
+
+    static double rate(double amount, double seconds) {
+        return seconds > 0 ? amount / seconds : 0;
+    }
+
+    // Keeps the TOP_FILES highest values of a field, highest first.  Most
+    // files do not make it, and those cost one comparison.
+    template <typename T>
+    static void insertTop(std::vector<tFileStat> &top, const char *szFullPath, unsigned long long bytes,
+                          double seconds, T tFileStat::*field) {
+        tFileStat file = { std::string(), bytes, seconds };
+        if (top.size() == TOP_FILES) {
+            if (file.*field <= top.back().*field)
+                return;
+            top.pop_back();
+        }
+        file.strPath = szFullPath;
+        top.push_back(file);
+        for (size_t i = top.size() - 1; i > 0 && top[i].*field > top[i - 1].*field; --i)
+            std::swap(top[i], top[i - 1]);
+    }
+
+    static void writeField(tOutput &out, const char *szName, unsigned long long value) {
+        out.write(",\"");
+        out.write(szName);
+        out.write("\":");
+        out.writeNumber(value);
+    }
+
+    static void writeFiles(tOutput &out, const char *szName, const std::vector<tFileStat> &files) {
+        char number[32];
+        out.write(",\"");
+        out.write(szName);
+        out.write("\":[");
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (i)
+                out.put(',');
+            out.write("{\"path\":");
+            out.writeJsonString(files[i].strPath.data(), files[i].strPath.size());
+            out.write(",\"bytes\":");
+            out.writeNumber(files[i].bytes);
+            snprintf(number, sizeof(number), ",\"seconds\":%.6f}", files[i].seconds);
+            out.write(number);
+        }
+        out.put(']');
+    }
+};
+
+#endif
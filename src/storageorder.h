@@ -0,0 +1,102 @@
+/*****************************************************************************/
+/* storageorder.h                            Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* ordering files by where their data sits in the data.NNN archives         */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_STORAGEORDER_H
+#define STORMEXTRACT_STORAGEORDER_H
+
+#include "../CascLib/src/CascCommon.h"
+
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+/* TCascFile is CascLib's private state, not part of its API.  Its fields are
+ * only read in the release they were checked against (1.00, the one the
+ * submodule tracks); with any other CascLib every file stays NO_ARCHIVE,
+ * which keeps the listing order and turns the cache hints off, instead of
+ * sorting on whatever the fields hold there.
+ */
+#if defined(CASCLIB_VERSION) && CASCLIB_VERSION == 0x0100
+#define STORMEXTRACT_FILE_LOCATIONS 1
+static_assert(std::is_integral<decltype(TCascFile::ArchiveIndex)>::value &&
+              std::is_integral<decltype(TCascFile::HeaderOffset)>::value,
+              "TCascFile no longer has the layout locateFiles() reads");
+#endif
+
+// Files that could not be opened go last, extractFile() reports them
+static const unsigned int NO_ARCHIVE = ~0U;
+
+struct tStorageLocation {
+    size_t index;                   // In the caller's list
+    unsigned int archive;           // The NNN of data.NNN, or NO_ARCHIVE
+    unsigned long long offset;      // Of the file's BLTE header in that archive
+};
+
+typedef std::function<const char *(size_t index)> tPathAt;
+
+// Whether locateFiles() can tell where files are with this CascLib
+inline bool canLocateFiles() {
+#ifdef STORMEXTRACT_FILE_LOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Find where each file is, in the order of the caller's list.
+ *
+ * CascLib has no public call for the location, so this looks into the file
+ * handle: CascOpenFile() fills ArchiveIndex and HeaderOffset from the index
+ * entry without reading any data, which keeps locating a whole storage
+ * cheap next to extracting it.
+ *
+ * @param count     How many files there are
+ * @param pathAt    The full path of file N
+ */
+inline std::vector<tStorageLocation> locateFiles(HANDLE hStorage, size_t count, const tPathAt &pathAt) {
+    std::vector<tStorageLocation> locations(count);
+    for (size_t i = 0; i < count; ++i) {
+        tStorageLocation &location = locations[i];
+        location.index = i;
+        location.archive = NO_ARCHIVE;
+        location.offset = 0;
+
+#ifdef STORMEXTRACT_FILE_LOCATIONS
+        HANDLE hFile;
+        if (CascOpenFile(hStorage, pathAt(i), CASC_LOCALE_ALL, 0, &hFile)) {
+            const TCascFile *file = (const TCascFile *) hFile;
+            location.archive = file->ArchiveIndex;
+            location.offset = file->HeaderOffset;
+            CascCloseFile(hFile);
+        }
+#else
+        (void) hStorage;
+        (void) pathAt;
+#endif
+    }
+    return locations;
+}
+
+/* Sort by archive, then by offset.
+ *
+ * CascFindNextFile() follows the root file, which jumps between archives at
+ * random; in this order reading the files becomes mostly sequential.
+ */
+inline void sortByStorage(std::vector<tStorageLocation> &locations) {
+    // Stable, so files sharing data keep the order they were found in
+    std::stable_sort(locations.begin(), locations.end(), [](const tStorageLocation &a, const tStorageLocation &b) {
+        return (a.archive != b.archive) ? (a.archive < b.archive) : (a.offset < b.offset);
+    });
+}
+
+inline std::vector<tStorageLocation> planStorageOrder(HANDLE hStorage, size_t count, const tPathAt &pathAt) {
+    std::vector<tStorageLocation> plan = locateFiles(hStorage, count, pathAt);
+    sortByStorage(plan);
+    return plan;
+}
+
+#endif
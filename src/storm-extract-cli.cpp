@@ -6,6 +6,11 @@
 
 #include <CascLib.h>
 #include <SimpleOpt.h>
+#include "bufferpool.h"
+#include "filter.h"
+#include "output.h"
+#include "paths.h"
+#include "pathtrie.h"
 #include <iostream>
 #include <string>
 #include <vector>
@@ -41,11 +46,14 @@ enum {
     OPT_SEARCH,
     OPT_LOWERCASE,
     OPT_LISTDIRS,
-    OPT_REGEX
+    OPT_REGEX,
+    OPT_IGNORECASE
 };
 
 bool bVerbose = false;      // Print extra information for logging
 bool bQuiet = false;        // Do not print anything.
+tOutput console(stdout);    // Everything for stdout goes through here
+tProgress progress(console);
 
 const CSimpleOpt::SOption COMMAND_LINE_OPTIONS[] = {
     { OPT_HELP,             "-h",               SO_NONE    },
@@ -70,6 +78,7 @@ const CSimpleOpt::SOption COMMAND_LINE_OPTIONS[] = {
     { OPT_FILEEXT,          "--extension",      SO_REQ_SEP },
     { OPT_SEARCH,           "-s",               SO_REQ_SEP },
     { OPT_SEARCH,           "--search",         SO_REQ_SEP },
+    { OPT_IGNORECASE,       "--ignore-case",    SO_NONE    },
     { OPT_LISTDIRS,         "-d",               SO_NONE    },
     { OPT_LISTDIRS,         "--directories",    SO_NONE    },
     // { OPT_REGEX,            "-r",               SO_REQ_SEP },
@@ -95,6 +104,7 @@ void showUsage(const std::string &pathToExecutable) {
          << "    -s, --search <STRING>     Restrict results to full paths matching STRING" << endl
          << "    -f, --filename <STRING>   Search for filenames matching STRING" << endl
          << "    -e, --extension <STRING>  Search for filenames having extension STRING" << endl
+         << "        --ignore-case         Match STRINGs regardless of upper/lowercase" << endl
          // << "    --exclude <ARG1> <ARGN>   Exclude any number of strings" << endl
          << endl
          << "  Search:     storm-extract [options]" << endl
@@ -136,73 +146,38 @@ void showUsage(const std::string &pathToExecutable) {
 // Overloaded echo command.
 void echo() {
     if (!bQuiet) {
-          cout << endl;
+        console.put('\n');
     }
 }
 
 void echo(const std::string &output) {
     if (!bQuiet) {
-        cout << output;
+        console.write(output);
     }
 }
 
 // Overloaded verbose command.
 void verbose() {
     if (!bQuiet && bVerbose) {
-          cout << endl;
+        console.put('\n');
     }
 }
 
 void verbose(const std::string &output) {
     if (!bQuiet && bVerbose) {
-        cout << output;
-    }
-}
-
-// Find out if the end of the string matches another string
-bool hasExtension(const std::string filename, const std::string extension) {
-    // http://stackoverflow.com/questions/874134/find-if-string-ends-with-another-string-in-c
-    return (
-        // Prevent exception of type std::out_of_range: basic_string because the file extension is greater than the filename
-        (filename.length() > extension.length()) &&
-        // http://stackoverflow.com/questions/874134/find-if-string-ends-with-another-string-in-c
-        (0 == filename.compare(filename.length() - extension.length(), extension.length(), extension))
-    );
-}
-
-void printCount( int count, string description ) {
-    if (!bQuiet) {
-        std::printf("%c[2K", 27);
-        std::cout << "\r  ";
-        std::cout.width( 7 );
-        std::cout << count << description;
-        std::cout << std::flush;
-    }
-}
-
-void printProgress( int percent, string description ) {
-    if (!bQuiet) {
-        std::printf("%c[2K", 27);
-        std::cout << "\r  ";
-        std::cout.width( 6 );
-        std::cout << percent << "% " << description;
-        std::cout << std::flush;
+        console.write(output);
     }
 }
 
 int main(int argc, char** argv) {
     HANDLE hStorage;
-    string strSearchPattern = "/";
-    string strFilePattern;
-    string strFileExt;
+    tSearchFilter searchFilter;
     string strSource = "/Applications/Heroes of the Storm";
     string strDestination = ".";
     vector<tSearchResult> searchResults;
     bool bUseFullPath = false;
     bool bLowerCase = false;
     bool bExtract = false;
-    bool bPattern = false;
-    bool bFileExt = false;
     bool bDirectories = false;
     int filesFound = 0;
     int filesDone = 0;
@@ -231,17 +206,17 @@ int main(int argc, char** argv) {
                     break;
 
                 case OPT_SEARCH:
-                    strSearchPattern = args.OptionArg();
+                    searchFilter.strSearchPattern = args.OptionArg();
                     break;
 
                 case OPT_FILEPTRN:
-                    bPattern = true;
-                    strFilePattern = args.OptionArg();
+                    searchFilter.bPattern = true;
+                    searchFilter.strFilePattern = args.OptionArg();
                     break;
 
                 case OPT_FILEEXT:
-                    bFileExt = true;
-                    strFileExt = args.OptionArg();
+                    searchFilter.bFileExt = true;
+                    searchFilter.strFileExt = args.OptionArg();
                     break;
 
                 case OPT_FULLPATH:
@@ -268,6 +243,10 @@ int main(int argc, char** argv) {
                     bDirectories = true;
                     break;
 
+                case OPT_IGNORECASE:
+                    searchFilter.bIgnoreCase = true;
+                    break;
+
                 // case OPT_REGEX:
                 //     bSearchPattern = true;
                 //     bRegex = true;
@@ -282,11 +261,7 @@ int main(int argc, char** argv) {
         }
     }
 
-    // if (bDirectories) {
-        std::set<string> directoryResults;
-        std::set<string>::iterator dIter;
-        std::pair<std::set<string>::iterator,bool> dRet;
-    // }
+    tPathTrie directoryTree;
 
     // Remove trailing slashes at the end of the storage path (CascLib doesn't like that)
     if ((strSource[strSource.size() - 1] == '/') || (strSource[strSource.size() - 1] == '\\'))
@@ -298,56 +273,54 @@ int main(int argc, char** argv) {
         return -2;
     }
 
+    // The verbose log already shows every file
+    if (bQuiet || bVerbose)
+        progress.disable();
+
     // Explain what we want to do
     echo("Searching for files: \n");
-    verbose("* full paths matching '" + strSearchPattern + "'\n");
-    if (bPattern) {
-        verbose("* filenames matching '" + strFilePattern + "'\n");
+    verbose("* full paths matching '" + searchFilter.strSearchPattern + "'\n");
+    if (searchFilter.bPattern) {
+        verbose("* filenames matching '" + searchFilter.strFilePattern + "'\n");
     }
-    if (bFileExt) {
-        verbose("* extensions matching '" + strFileExt + "'\n");
+    if (searchFilter.bFileExt) {
+        verbose("* extensions matching '" + searchFilter.strFileExt + "'\n");
     }
-    if (bFileExt || bPattern) {
+    if (searchFilter.bFileExt || searchFilter.bPattern) {
         verbose();
     }
 
     // Set up structure
     CASC_FIND_DATA findData;
-    HANDLE handle = CascFindFirstFile(hStorage, "*", &findData, NULL);
+    string strMask = searchFilter.findMask();
+    HANDLE handle = CascFindFirstFile(hStorage, strMask.c_str(), &findData, NULL);
 
     if (handle) {
 
         do {
-            tSearchResult r;
-            r.strFileName = findData.szPlainName;
-            r.strFullPath = findData.szFileName;
-
-            if (r.strFullPath.find(strSearchPattern) != std::string::npos) {
-                if (
-                    // No file pattern, No file type
-                    (!bPattern && !bFileExt) ||
-                    // No file pattern, Yes file type AND file type match.
-                    (!bPattern && bFileExt && hasExtension(r.strFileName, strFileExt)) ||
-                    // File name contains search pattern, No file type
-                    (bPattern && r.strFileName.find(strFilePattern) != std::string::npos && !bFileExt) ||
-                    // File name contains search pattern AND matches file type
-                    (bPattern && r.strFileName.find(strFilePattern) != std::string::npos && bFileExt &&
-                        hasExtension(r.strFileName, strFileExt))
-                ){
-                    if ( bDirectories ) {
-                        directoryResults.insert(r.strFullPath.substr(0,r.strFullPath.size()-r.strFileName.length()));
-                    } else {
-                        filesFound++;
-                        printCount(filesFound, " matches...");
-                        searchResults.push_back(r);
-                        verbose(findData.szFileName);
-                        verbose();
-                    }
+            const char *szPlainName = findData.szPlainName;
+            size_t nFullPath = strlen(findData.szFileName);
+            size_t nPlainName = nFullPath - size_t(szPlainName - findData.szFileName);
+
+            if (searchFilter.matches(findData.szFileName, nFullPath, szPlainName, nPlainName, findData.dwFileSize)) {
+                if ( bDirectories ) {
+                    directoryTree.addFile(findData.szFileName, nFullPath - nPlainName, findData.dwFileSize);
+                } else {
+                    tSearchResult r;
+                    r.strFileName.assign(szPlainName, nPlainName);
+                    r.strFullPath.assign(findData.szFileName, nFullPath);
+
+                    filesFound++;
+                    progress.update(filesFound, 0, "matches...");
+                    searchResults.push_back(r);
+                    verbose(findData.szFileName);
+                    verbose();
                 }
             }
         } while (CascFindNextFile(handle, &findData) && findData.szPlainName);
 
         CascFindClose(handle);
+        progress.finish();
     } else {
         echo("  No files found!\n");
         return -3;
@@ -355,71 +328,45 @@ int main(int argc, char** argv) {
     echo();
 
     if ( bDirectories ) {
-        for (dIter=directoryResults.begin(); dIter!=directoryResults.end(); ++dIter)
-            std::cout << ' ' << *dIter << endl;
-        std::cout << '\n';
+        auto printDirectory = [](const string &strPath, const tPathTrie::tNode &) {
+            echo(" " + strPath + "/\n");
+        };
+        directoryTree.visit(printDirectory);
+        echo();
     }
 
     // Extraction
     if (bExtract && !searchResults.empty())
     {
-        char buffer[1000000];
+        tBuffer buffer = tBufferPool::shared().acquire(0x100000);
+        if (!buffer) {
+            cerr << "ERROR: Failed to allocate the extraction buffer" << endl;
+            return -2;
+        }
 
         echo("Extracting files:\n");
 
         if (strDestination.at(strDestination.size() - 1) != '/')
             strDestination += "/";
 
+        // Reused for every file, it only grows to the longest path seen
+        tDestPath destPath;
+        destPath.setRoot(strDestination);
+
         vector<tSearchResult>::iterator iter, iterEnd;
         for (iter = searchResults.begin(), iterEnd = searchResults.end(); iter != iterEnd; ++iter)
         {
-            string strDestName = strDestination;
-
             if (bUseFullPath)
             {
-                if (bLowerCase){
-                    transform(iter->strFullPath.begin(), iter->strFullPath.end(), iter->strFullPath.begin(), ::tolower);
-                }
-
-                strDestName += iter->strFullPath;
-
-                size_t offset = strDestName.find("\\");
-                while (offset != string::npos)
-                {
-                    strDestName = strDestName.substr(0, offset) + "/" + strDestName.substr(offset + 1);
-                    offset = strDestName.find("\\");
-                }
-
-                offset = strDestName.find_last_of("/");
-                if (offset != string::npos)
-                {
-                    string dest = strDestName.substr(0, offset + 1);
-
-                    size_t start = dest.find("/", 0);
-                    while (start != string::npos)
-                    {
-                        string dirname = dest.substr(0, start);
-
-                        DIR* d = opendir(dirname.c_str());
-                        if (!d)
-                            mkdir(dirname.c_str(), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-                        else
-                            closedir(d);
-
-                        start = dest.find("/", start + 1);
-                    }
-                }
+                destPath.build(iter->strFullPath.data(), iter->strFullPath.size(), bLowerCase);
+                destPath.createDirectories();   // fopen() reports what went wrong
             }
             else
             {
-                if (bLowerCase){
-                    transform(iter->strFileName.begin(), iter->strFileName.end(), iter->strFileName.begin(), ::tolower);
-                }
-
-                strDestName += iter->strFileName;
+                destPath.build(iter->strFileName.data(), iter->strFileName.size(), bLowerCase);
             }
+            const string &strDestName = destPath.path();
 
-            int progress = 0;
             HANDLE hFile;
             if (CascOpenFile(hStorage, iter->strFullPath.c_str(), CASC_LOCALE_ALL, 0, &hFile))
             {
@@ -428,30 +375,33 @@ int main(int argc, char** argv) {
                 if (dest)
                 {
                     do {
-                        if (CascReadFile(hFile, &buffer, 1000000, &read))
-                            fwrite(&buffer, read, 1, dest);
+                        if (CascReadFile(hFile, buffer.data(), DWORD(buffer.size()), &read))
+                            fwrite(buffer.data(), read, 1, dest);
                     } while (read > 0);
 
                     fclose(dest);
                 }
                 else
                 {
+                    progress.finish();
                     cerr << "ERROR: Failed to extract '" << iter->strFullPath << "' to " << strDestName << endl;
                 }
                 filesDone++;
-                progress = (filesDone * 100 / filesFound);
-                printProgress(progress, iter->strFullPath);
+                progress.update(filesDone, filesFound, iter->strFullPath.c_str());
 
                 CascCloseFile(hFile);
             }
             else
             {
+                progress.finish();
                 cerr << "ERROR: Failed to extract '" << iter->strFullPath << "' to " << strDestName << endl;
             }
         }
     }
 
+    progress.finish();
     CascCloseStorage(hStorage);
+    console.flush();
 
     return 0;
 }
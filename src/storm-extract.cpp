@@ -9,6 +9,22 @@
 #endif
 #include "../CascLib/src/CascLib.h"
 #include "../include/SimpleOpt.h"
+#include "blockcache.h"
+#include "bufferpool.h"
+#include "cachehints.h"
+#include "filter.h"
+#include "manifest.h"
+#include "output.h"
+#include "paths.h"
+#include "pathtrie.h"
+#include "pipeoutput.h"
+#include "results.h"
+#include "stats.h"
+#include "storageorder.h"
+#include "table.h"
+#include "trace.h"
+#include "verify.h"
+#include "workers.h"
 
 #include <iostream>
 #include <string>
@@ -18,8 +34,12 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <set>
+#include <deque>
+#include <memory>
 //#include <regex>
 
 using namespace std;
@@ -28,12 +48,6 @@ using namespace std;
 // All the global variables
 string version = "1.0.3";
 
-struct tSearchResult {
-    string strFileName;
-    string strFullPath;
-    DWORD lFileSize;
-};
-
 // Valid options
 enum {
     OPT_HELP,
@@ -48,23 +62,77 @@ enum {
     OPT_SEARCH,
     OPT_LOWERCASE,
     OPT_LISTDIRS,
-    OPT_REGEX
+    OPT_REGEX,
+    OPT_IGNORECASE,
+    OPT_MINSIZE,
+    OPT_MAXSIZE,
+    OPT_SORT,
+    OPT_PREFIX,
+    OPT_DISKUSAGE,
+    OPT_JOBS,
+    OPT_FORMAT,
+    OPT_EXPORTTABLE,
+    OPT_TABLE,
+    OPT_STATS,
+    OPT_STATSJSON,
+    OPT_TRACE,
+    OPT_STORAGEORDER,
+    OPT_CACHEHINTS,
+    OPT_CAT,
+    OPT_RANGE,
+    OPT_MANIFEST,
+    OPT_VERIFY
+};
+
+// Listing orders
+enum {
+    SORT_NONE,                  // Storage order, printed while searching
+    SORT_NAME,                  // Full path, ascending
+    SORT_SIZE                   // Largest first, then by full path
+};
+
+// Listing formats
+enum {
+    FORMAT_TEXT,                // For people, with -v
+    FORMAT_NULL,                // Full paths, each followed by a NUL (xargs -0)
+    FORMAT_JSONL,               // One JSON object per line
+    FORMAT_TSV                  // Path, name, size and key separated by tabs
 };
 
 HANDLE hStorage;
-string strSearchPattern = "/";
-string strFilePattern;
-string strFileExt;
+tSearchFilter searchFilter;
 string strSource = "/Applications/Heroes of the Storm";
 string strDestination = ".";
+bool bDestination = false;  // -o was given, --verify takes its own
+tDestPath destPath;         // Built from strDestination for each file extracted
 bool bUseFullPath = true;
-// bool bLowerCase = false;
+bool bLowerCase = false;
 bool bExtract = false;
-bool bPattern = false;
-bool bFileExt = false;
-// bool bDirectories = false;
+bool bStorageOrder = false; // Extract by position in the data archives
+bool bCacheHints = false;   // posix_fadvise() the archives and the extracted files
+tCacheHints cacheHints;
+string strCatPath;          // Write this file to stdout instead of searching
+unsigned long long nRangeOffset = 0;        // Part of it, for --range
+unsigned long long nRangeLength = ~0ULL;
+int sortOrder = SORT_NONE;
+bool bDirectories = false;
+bool bDiskUsage = false;    // Directories with file counts and sizes
+tPathTrie directoryTree;
+int outputFormat = FORMAT_TEXT;
+string strExportTable;      // Write the matches there as a table
+tFileTable fileTable;       // Search this instead of the storage, when open
+tStats stats;
+string strStatsJson;        // Also write the statistics there
+string strManifest;         // Write path, size and MD5 of the extracted files there
+tManifest manifest;
+string strVerify;           // Compare the matches with the files below it
+tTracer tracer;             // Spans for --trace, off unless opened
+int nJobs = 1;              // Threads filtering the file table, 0 for one per core
+bool bJobs = false;         // -j was given, --verify uses one thread per core otherwise
 bool bVerbose = false;      // Print extra information for logging
 bool bQuiet = false;        // Do not print anything.
+tOutput console(stdout);    // Everything for stdout goes through here
+tProgress progress(console);
 
 const CSimpleOpt::SOption COMMAND_LINE_OPTIONS[] = {
     { OPT_HELP,             "-h",               SO_NONE    },
@@ -81,16 +149,36 @@ const CSimpleOpt::SOption COMMAND_LINE_OPTIONS[] = {
     { OPT_DEST,             "--out",            SO_REQ_SEP },
     //{ OPT_FULLPATH,         "-p",               SO_NONE    },
     //{ OPT_FULLPATH,         "--path",           SO_NONE    },
-    //{ OPT_LOWERCASE,        "-c",               SO_NONE    },
-    //{ OPT_LOWERCASE,        "--lowercase",      SO_NONE    },
+    { OPT_LOWERCASE,        "-c",               SO_NONE    },
+    { OPT_LOWERCASE,        "--lowercase",      SO_NONE    },
+    { OPT_STORAGEORDER,     "--storage-order",  SO_NONE    },
+    { OPT_CACHEHINTS,       "--cache-hints",    SO_NONE    },
+    { OPT_CAT,              "--cat",            SO_REQ_SEP },
+    { OPT_RANGE,            "--range",          SO_REQ_SEP },
+    { OPT_MANIFEST,         "--manifest",       SO_REQ_SEP },
+    { OPT_VERIFY,           "--verify",         SO_REQ_SEP },
+    { OPT_IGNORECASE,       "--ignore-case",    SO_NONE    },
     { OPT_FILEPTRN,         "-f",               SO_REQ_SEP },
     { OPT_FILEPTRN,         "--filename",       SO_REQ_SEP },
     { OPT_FILEEXT,          "-t",               SO_REQ_SEP },
     { OPT_FILEEXT,          "--filetype",       SO_REQ_SEP },
     { OPT_SEARCH,           "-s",               SO_REQ_SEP },
     { OPT_SEARCH,           "--search",         SO_REQ_SEP },
-    // { OPT_LISTDIRS,         "-d",               SO_NONE    },
-    // { OPT_LISTDIRS,         "--directories",    SO_NONE    },
+    { OPT_PREFIX,           "--prefix",         SO_REQ_SEP },
+    { OPT_MINSIZE,          "--min-size",       SO_REQ_SEP },
+    { OPT_MAXSIZE,          "--max-size",       SO_REQ_SEP },
+    { OPT_SORT,             "--sort",           SO_REQ_SEP },
+    { OPT_FORMAT,           "--format",         SO_REQ_SEP },
+    { OPT_EXPORTTABLE,      "--export-table",   SO_REQ_SEP },
+    { OPT_TABLE,            "--table",          SO_REQ_SEP },
+    { OPT_STATS,            "--stats",          SO_NONE    },
+    { OPT_STATSJSON,        "--stats-json",     SO_REQ_SEP },
+    { OPT_TRACE,            "--trace",          SO_REQ_SEP },
+    { OPT_JOBS,             "-j",               SO_REQ_SEP },
+    { OPT_JOBS,             "--jobs",           SO_REQ_SEP },
+    { OPT_LISTDIRS,         "-d",               SO_NONE    },
+    { OPT_LISTDIRS,         "--directories",    SO_NONE    },
+    { OPT_DISKUSAGE,        "--du",             SO_NONE    },
     // { OPT_REGEX,            "-r",               SO_REQ_SEP },
     // { OPT_REGEX,            "--regex",          SO_REQ_SEP },
 
@@ -113,8 +201,25 @@ void showUsage(const std::string &pathToExecutable) {
          << "    -v, --verbose             Prints more information" << endl
          << "    -q, --quiet               Prints nothing, nada, zip" << endl
          << "    -s, --search <STRING>     Restrict results to full paths matching STRING" << endl
+         << "        --prefix <PATH>       Restrict results to full paths starting with PATH" << endl
+         << "                                (a --table skips to it, except with --ignore-case)" << endl
          << "    -f, --filename <STRING>   Search for filenames matching STRING" << endl
          << "    -t, --filetype <STRING>   Search for filenames having extension STRING" << endl
+         << "        --ignore-case         Match STRINGs regardless of upper/lowercase" << endl
+         << "        --min-size <SIZE>     Only files of at least SIZE bytes (suffixes K, M, G)" << endl
+         << "        --max-size <SIZE>     Only files of at most SIZE bytes (suffixes K, M, G)" << endl
+         << "        --sort <name|size>    List by full path, or largest files first" << endl
+         << "        --format <FORMAT>     List every match as 'null' (NUL separated paths)," << endl
+         << "                                'jsonl' or 'tsv' (path, name, size, content key)" << endl
+         << "                                instead of text; nothing else goes to stdout" << endl
+         << "        --table <FILE>        Search a table saved by --export-table instead of" << endl
+         << "                                the storage (which is only opened to extract)" << endl
+         << "        --stats               Print timings, rates and failures to stderr at the end" << endl
+         << "        --stats-json <FILE>   Also write them to FILE as JSON" << endl
+         << "        --trace <FILE>        Record what every thread did, and when, to FILE in the" << endl
+         << "                                Chrome trace-event format (chrome://tracing)" << endl
+         << "    -j, --jobs <N>            Filter the file table and verify files on N threads" << endl
+         << "                                (0: one per core; default 1, and one per core to verify)" << endl
          // << "    --exclude <ARG1> <ARGN>   Exclude any number of strings" << endl
          << endl
          << "  Search:     storm-extract [options]" << endl
@@ -125,10 +230,33 @@ void showUsage(const std::string &pathToExecutable) {
          << "                                (default: current working directory)" << endl
          // << "    -p, --path                During extraction, preserve the path hierarchy found" << endl
          // << "                                inside the storage (extract only)" << endl
-         // << "    -c, --lowercase           Convert extracted file paths to lowercase (extract only)" <<endl
-         // << endl
-         // << "  Directory:  storm-extract -d [options]" << endl
-         // << "    -d, --directories         Print all directories found" << endl
+         << "    -c, --lowercase           Convert extracted file paths to lowercase (extract only)" <<endl
+         << "        --storage-order       Extract in the order the files are stored, which reads" << endl
+         << "                                the archives mostly sequentially (extract only)" << endl
+         << "        --cache-hints         Have the kernel read ahead in the archives, and keep" << endl
+         << "                                what was extracted out of the page cache (extract only)" << endl
+         << "        --manifest <FILE>     Write the path, size and MD5 of every extracted file to" << endl
+         << "                                FILE, hashed while they are written (extract only, not --verify)" << endl
+         << endl
+         << "  Verify:     storm-extract --verify <PATH> [-x] [options]" << endl
+         << "        --verify <PATH>       Compare the files found with those already extracted to" << endl
+         << "                                PATH (sizes, then contents) and print the missing," << endl
+         << "                                truncated or different ones; with -x, extract only" << endl
+         << "                                those into PATH" << endl
+         << endl
+         << "  Export:     storm-extract --export-table <FILE> [options]" << endl
+         << "        --export-table <FILE> Save the files found, with their sizes, content keys" << endl
+         << "                                and locales, as a binary table sorted by path" << endl
+         << endl
+         << "  Print:      storm-extract --cat <PATH> [options]" << endl
+         << "        --cat <PATH>          Write the file at full path PATH to stdout" << endl
+         << "        --range <OFF:LEN>     Only LEN bytes from offset OFF on (suffixes K, M, G," << endl
+         << "                                no LEN for the rest of the file)" << endl
+         << endl
+         << "  Directory:  storm-extract -d [options]" << endl
+         << "    -d, --directories         Print all directories found" << endl
+         << "        --du                  Print all directories found, with the number and" << endl
+         << "                                total size of the files below each of them" << endl
          << endl
          << "Examples:" << endl
          << endl
@@ -155,209 +283,608 @@ void showUsage(const std::string &pathToExecutable) {
 // Overloaded echo command.
 void echo() {
     if (!bQuiet) {
-          cout << endl;
+        console.put('\n');
     }
 }
 
 void echo(const std::string &output) {
     if (!bQuiet) {
-        cout << output;
+        console.write(output);
+    }
+}
+
+void echo(const char *output) {
+    if (!bQuiet) {
+        console.write(output);
     }
 }
 
 void echo(const int &output) {
     if (!bQuiet) {
-        cout << output;
+        if (output < 0)
+            console.put('-');
+        console.writeNumber(output < 0 ? -(long long) output : output);
     }
 }
 
 // Overloaded verbose command.
 void verbose() {
     if (!bQuiet && bVerbose) {
-          cout << endl;
+        console.put('\n');
     }
 }
 
 void verbose(const std::string &output) {
     if (!bQuiet && bVerbose) {
-        cout << output;
+        console.write(output);
     }
 }
 
-void verbose(const int &output) {
+void verbose(const char *output) {
     if (!bQuiet && bVerbose) {
-        cout << output;
+        console.write(output);
     }
 }
 
-// Find out if the end of the string matches another string
-bool hasExtension(const std::string filename, const std::string extension) {
-    // http://stackoverflow.com/questions/874134/find-if-string-ends-with-another-string-in-c
-    return (
-        // Prevent exception of type std::out_of_range: basic_string because the file extension is greater than the filename
-        (filename.length() > extension.length()) &&
-        // http://stackoverflow.com/questions/874134/find-if-string-ends-with-another-string-in-c
-        (0 == filename.compare(filename.length() - extension.length(), extension.length(), extension))
-    );
+void verbose(const int &output) {
+    if (!bQuiet && bVerbose) {
+        if (output < 0)
+            console.put('-');
+        console.writeNumber(output < 0 ? -(long long) output : output);
+    }
 }
 
-void printCount( int count, string description ) {
-    if (!bQuiet) {
-        std::printf("%c[2K", 27);
-        std::cout << "\r  ";
-        std::cout.width( 7 );
-        std::cout << count << description;
-        std::cout << std::flush;
+// A run of consecutive file table entries, filtered by one worker
+struct tSearchChunk {
+    tSearchResults entries;
+    std::vector<char> matched;
+    bool bDone;
+};
+
+static const size_t SEARCH_CHUNK_SIZE = 4096;
+
+/* Filter the rest of an enumeration on a pool of threads.
+ *
+ * Only CascFindNextFile() has to stay on this thread: entries are copied in
+ * chunks, each chunk is filtered by a worker, and finished chunks are handed
+ * to the visitor strictly in the order they were read.  The visitor sees
+ * exactly what the sequential loop would show it.
+ */
+size_t searchChunks(HANDLE handle, CASC_FIND_DATA &findData, const tSearchVisitor &visit, size_t nThreads) {
+    size_t filesFound = 0;
+    bool bMore = true;
+    bool bStopped = false;
+
+    std::mutex mutex;
+    std::condition_variable chunkDone;
+    std::deque<std::shared_ptr<tSearchChunk> > inFlight;
+    std::vector<std::shared_ptr<tSearchChunk> > spare;
+    tWorkerPool pool(nThreads);
+
+    while ((bMore || !inFlight.empty()) && !bStopped) {
+        // Keep every worker busy, with one chunk queued behind each of them
+        while (bMore && inFlight.size() < 2 * nThreads) {
+            std::shared_ptr<tSearchChunk> chunk;
+            if (spare.empty()) {
+                chunk = std::make_shared<tSearchChunk>();
+                chunk->entries.reserve(SEARCH_CHUNK_SIZE);
+            } else {
+                chunk = spare.back();
+                spare.pop_back();
+                chunk->entries.clear();
+            }
+            chunk->bDone = false;
+
+            do {
+                size_t nFullPath = strlen(findData.szFileName);
+                size_t nPlainOffset = size_t(findData.szPlainName - findData.szFileName);
+                chunk->entries.add(findData.szFileName, nFullPath, nPlainOffset, findData.dwFileSize, findData.EncodingKey,
+                                   findData.dwLocaleFlags);
+                bMore = CascFindNextFile(handle, &findData) && findData.szPlainName;
+            } while (bMore && chunk->entries.size() < SEARCH_CHUNK_SIZE);
+
+            stats.entriesSeen += chunk->entries.size();
+            inFlight.push_back(chunk);
+            pool.submit([chunk, &mutex, &chunkDone]() {
+                tTraceSpan span(tracer, "filter chunk");
+                const tSearchResults &entries = chunk->entries;
+                chunk->matched.resize(entries.size());
+                for (size_t i = 0; i < entries.size(); ++i) {
+                    tSearchMatch match = entries.match(entries[i]);
+                    chunk->matched[i] = searchFilter.matches(match.szFullPath, match.nFullPath,
+                                                             match.szPlainName, match.nPlainName, match.fileSize);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                chunk->bDone = true;
+                chunkDone.notify_all();
+            });
+        }
+
+        // Hand the oldest chunk over once it is filtered
+        std::shared_ptr<tSearchChunk> chunk = inFlight.front();
+        {
+            tTraceSpan span(tracer, "wait for chunk");
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!chunk->bDone)
+                chunkDone.wait(lock);
+        }
+        inFlight.pop_front();
+
+        const tSearchResults &entries = chunk->entries;
+        for (size_t i = 0; i < entries.size() && !bStopped; ++i) {
+            if (chunk->matched[i]) {
+                filesFound++;
+                bStopped = !visit(entries.match(entries[i]));
+            }
+        }
+        spare.push_back(chunk);
     }
+
+    // The pool finishes whatever is still queued before it goes away
+    return filesFound;
 }
 
-void printProgress( int percent, string description ) {
-    if (!bQuiet && bVerbose) {
-        std::printf("%c[2K", 27);
-        std::cout << "\r  ";
-        std::cout.width( 6 );
-        std::cout << percent << "% " << description;
-        std::cout << std::flush;
+/* Search a table loaded with --table.
+ *
+ * Rows are sorted by full path, so a case-sensitive prefix only walks the
+ * rows that start with it.
+ */
+size_t searchTable(const tSearchVisitor &visit) {
+    size_t filesFound = 0;
+    size_t first = 0;
+    bool bPrefixRange = !searchFilter.strPrefix.empty() && !searchFilter.bIgnoreCase;
+    if (bPrefixRange)
+        first = fileTable.lowerBound(searchFilter.strPrefix.data(), searchFilter.strPrefix.size());
+
+    for (size_t i = first; i < fileTable.size(); ++i) {
+        tSearchMatch match = fileTable.row(i);
+        stats.entriesSeen++;
+        if (bPrefixRange && !searchFilter.hasPrefix(match.szFullPath, match.nFullPath))
+            break;
+
+        if (searchFilter.matches(match.szFullPath, match.nFullPath, match.szPlainName, match.nPlainName, match.fileSize)) {
+            filesFound++;
+            if (!visit(match))
+                break;
+        }
     }
+    return filesFound;
 }
 
-vector<string> searchArchive() {
-    // Instantiate variables
-    int filesFound = 0;
-    vector<string> ret;
-    std::set<string> directoryResults;
-    std::set<string>::iterator dIter;
+/* Search the storage, handing every match to a visitor as soon as it is found.
+ *
+ * @return the number of matches
+ */
+size_t searchArchive(const tSearchVisitor &visit) {
+    tTraceSpan span(tracer, "search");
+    size_t filesFound = 0;
+
+    if (fileTable.isOpen())
+        return searchTable(visit);
 
-    // Let's do dis...
+    // Let's do dis... CascLib still walks every name, the mask only saves the copies
     CASC_FIND_DATA findData;
-    HANDLE handle = CascFindFirstFile(hStorage, "*", &findData, NULL);
+    string strMask = searchFilter.findMask();
+    HANDLE handle = CascFindFirstFile(hStorage, strMask.c_str(), &findData, NULL);
+
+    size_t nThreads = (nJobs > 0) ? size_t(nJobs) : tWorkerPool::defaultThreads();
 
     // Looper
-    if (handle) {
+    if (handle && nThreads > 1) {
+        filesFound = searchChunks(handle, findData, visit, nThreads);
+        CascFindClose(handle);
+    } else if (handle) {
         do {
-            tSearchResult r;
-            r.strFileName = findData.szPlainName;
-            r.strFullPath = findData.szFileName;
-            r.lFileSize = findData.dwFileSize;
-
-
-            if (r.strFullPath.find(strSearchPattern) != std::string::npos) {
-                if (
-                    // No file pattern, No file type
-                    (!bPattern && !bFileExt) ||
-                    // No file pattern, Yes file type AND file type match.
-                    (!bPattern && bFileExt && hasExtension(r.strFileName, strFileExt)) ||
-                    // File name contains search pattern, No file type
-                    (bPattern && r.strFileName.find(strFilePattern) != std::string::npos && !bFileExt) ||
-                    // File name contains search pattern AND matches file type
-                    (bPattern && r.strFileName.find(strFilePattern) != std::string::npos && bFileExt &&
-                        hasExtension(r.strFileName, strFileExt))
-                ){
-                    // if ( bDirectories ) {
-                    //     directoryResults.insert(r.strFullPath.substr(0,r.strFullPath.size()-r.strFileName.length()));
-                    // } else {
-                        ret.push_back(r.strFullPath);
-                        // Debug
-                        filesFound++;
-                        //printCount(filesFound, " matches...");
-                        verbose("  - ");
-                        verbose(findData.szFileName);
-                        verbose();
-                    // }
-                }
+            tSearchMatch match;
+            match.szFullPath = findData.szFileName;
+            match.nFullPath = strlen(findData.szFileName);
+            match.szPlainName = findData.szPlainName;
+            match.nPlainName = match.nFullPath - size_t(match.szPlainName - match.szFullPath);
+            match.fileSize = findData.dwFileSize;
+            match.contentKey = findData.EncodingKey;
+            match.localeFlags = findData.dwLocaleFlags;
+            stats.entriesSeen++;
+
+            if (searchFilter.matches(match.szFullPath, match.nFullPath, match.szPlainName, match.nPlainName, match.fileSize)) {
+                filesFound++;
+                if (!visit(match))
+                    break;
             }
         } while (CascFindNextFile(handle, &findData) && findData.szPlainName);
 
         CascFindClose(handle);
     }
 
-    // if ( bDirectories && !directoryResults.empty() ) {
-    //     for (dIter = directoryResults.begin(); dIter != directoryResults.end(); ++dIter) {
-    //         ret.push_back(*dIter);
-    //     }
-    // }
+    return filesFound;
+}
 
+// Collect every match, for when the whole list is needed before going on
+tSearchResults collectResults() {
+    tSearchResults ret;
+
+    // Size the results for the whole storage up front.  A table knows the
+    // length of all its paths, so its heap is never copied while growing;
+    // for a storage it is a guess, and may be outgrown once or twice.
+    DWORD dwFileCount = 0;
+    if (fileTable.isOpen())
+        ret.reserve(fileTable.size(), fileTable.heapSize());
+    else if (CascGetStorageInfo(hStorage, CascStorageFileCount, &dwFileCount, sizeof(DWORD), NULL))
+        ret.reserve(dwFileCount);
+
+    searchArchive([&ret](const tSearchMatch &match) {
+        ret.add(match);
+        return true;
+    });
     return ret;
 }
 
-size_t extractFile(string strFullPath) {
-    char buffer[0x100000];  // 1MB buffer
-    string strDestName = strDestination;
+bool compareByName(const tSearchResults &results, const tSearchResults::tEntry &a, const tSearchResults::tEntry &b) {
+    return results.comparePaths(a, b) < 0;
+}
+
+bool compareBySize(const tSearchResults &results, const tSearchResults::tEntry &a, const tSearchResults::tEntry &b) {
+    if (a.fileSize != b.fileSize)
+        return a.fileSize > b.fileSize;
+    return results.comparePaths(a, b) < 0;
+}
+
+// Prints one line of the directory listing
+struct tDirectoryPrinter {
+    void operator()(const string &strPath, const tPathTrie::tNode &node) {
+        if (bDiskUsage) {
+            char line[64];
+            snprintf(line, sizeof(line), "  %14llu %9llu  ", node.totalBytes, node.totalFiles);
+            echo(line);
+        } else {
+            echo("  - ");
+        }
+        echo(strPath + "/\n");
+    }
+};
+
+/* Print one match of the listing, in the format asked for.
+ *
+ * The machine formats are written even with -q, they are the whole output.
+ */
+void listMatch(const tSearchMatch &match) {
+    switch (outputFormat) {
+        case FORMAT_TEXT:
+            verbose("  - ");
+            verbose(match.szFullPath);
+            if (sortOrder == SORT_SIZE) {
+                verbose(" (" + to_string(match.fileSize) + " bytes)");
+            }
+            verbose();
+            break;
+
+        case FORMAT_NULL:
+            console.write(match.szFullPath, match.nFullPath);
+            console.put('\0');
+            break;
+
+        case FORMAT_JSONL:
+            console.write("{\"path\":", 8);
+            console.writeJsonString(match.szFullPath, match.nFullPath);
+            console.write(",\"name\":", 8);
+            console.writeJsonString(match.szPlainName, match.nPlainName);
+            console.write(",\"size\":", 8);
+            console.writeNumber(match.fileSize);
+            if (hasContentKey(match.contentKey)) {
+                console.write(",\"key\":\"", 8);
+                console.writeHex(match.contentKey, CONTENT_KEY_SIZE);
+                console.put('"');
+            }
+            console.write("}\n", 2);
+            break;
+
+        case FORMAT_TSV:
+            console.write(match.szFullPath, match.nFullPath);
+            console.put('\t');
+            console.write(match.szPlainName, match.nPlainName);
+            console.put('\t');
+            console.writeNumber(match.fileSize);
+            console.put('\t');
+            if (hasContentKey(match.contentKey)) {
+                console.writeHex(match.contentKey, CONTENT_KEY_SIZE);
+            }
+            console.put('\n');
+            break;
+    }
+}
+
+void sortResults(tSearchResults &results) {
+    if (sortOrder == SORT_NAME)
+        results.sort(compareByName);
+    else if (sortOrder == SORT_SIZE)
+        results.sort(compareBySize);
+}
+
+/* Extract one file below strDestination.
+ *
+ * @return false if it could not be read or written, the reason is on stderr
+ */
+bool extractFile(const char *szFullPath) {
+    tTraceSpan span(tracer, "extract", szFullPath);
 
 /*
     if (bUseFullPath)
     {
-        // if (bLowerCase){
-        //     transform(iter->strFullPath.begin(), iter->strFullPath.end(), iter->strFullPath.begin(), ::tolower);
-        // }
 */
-        strDestName += strFullPath;
+        destPath.build(szFullPath, strlen(szFullPath), bLowerCase);
 
-        size_t offset = strDestName.find("\\");
-        while (offset != string::npos)
+        int directoryError = 0;
         {
-            strDestName = strDestName.substr(0, offset) + "/" + strDestName.substr(offset + 1);
-            offset = strDestName.find("\\");
+            tTraceSpan span(tracer, "create directories");
+            if (!destPath.createDirectories())
+                directoryError = errno;
         }
-
-        offset = strDestName.find_last_of("/");
-        if (offset != string::npos)
+        if (directoryError)
         {
-            string dest = strDestName.substr(0, offset + 1);
-
-            size_t start = dest.find("/", 0);
-            while (start != string::npos)
-            {
-                string dirname = dest.substr(0, start);
-
-                DIR* d = opendir(dirname.c_str());
-                if (!d)
-                    mkdir(dirname.c_str(), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-                else
-                    closedir(d);
-
-                start = dest.find("/", start + 1);
-            }
+            stats.createFailures++;
+            progress.finish();
+            cerr << "NOFILE: (" << directoryError << ") Failed to extract '" << szFullPath << "' to " << destPath.path() << endl;
+            return false;
         }
 /*
     } else {
-        // if (bLowerCase){
-        //     transform(strFileName.begin(), strFileName.end(), strFileName.begin(), ::tolower);
-        // }
-
-        strDestName += strFileName;
+        destPath.build(strFileName.data(), strFileName.size(), bLowerCase);
     }
 */
+    const string &strDestName = destPath.path();
+
+    double startTime = stats.bEnabled ? tStats::wallClock() : 0;
 
     HANDLE hFile;
-    size_t fileSize = 0;
-    if (CascOpenFile(hStorage, strFullPath.c_str(), CASC_LOCALE_ALL, 0, &hFile))
+    bool bOpened;
     {
-        DWORD read;
-        FILE* dest = fopen(strDestName.c_str(), "wb");
-        if (dest)
-        {
-            do {
-                if (CascReadFile(hFile, &buffer, 0x100000, &read)) {
-                    fileSize += fwrite(&buffer, read, 1, dest);
-                }
-            } while (read > 0);
+        tTraceSpan span(tracer, "open");
+        bOpened = CascOpenFile(hStorage, szFullPath, CASC_LOCALE_ALL, 0, &hFile);
+    }
+    if (!bOpened)
+    {
+        int error = errno;
+        stats.openFailures++;
+        progress.finish();
+        cerr << "NOARCHIVE: (" << error << ") Failed to extract '" << szFullPath << "' to " << strDestName << endl;
+        return false;
+    }
 
-            fclose(dest);
-        }
-        else
+    FILE* dest;
+    {
+        tTraceSpan span(tracer, "create");
+        dest = fopen(strDestName.c_str(), "wb");
+    }
+    if (!dest)
+    {
+        int error = errno;
+        stats.createFailures++;
+        CascCloseFile(hFile);
+        progress.finish();
+        cerr << "NOFILE: (" << error << ") Failed to extract '" << szFullPath << "' to " << strDestName << endl;
+        return false;
+    }
+
+    // fwrite() is given bytes, not one chunk, so short writes show up
+    unsigned long long fileSize = 0;
+    tBuffer buffer = tBufferPool::shared().acquire(0x100000);
+    tMD5 md5;
+    bool bRead = bool(buffer);
+    bool bWritten = true;
+    DWORD read = 0;
+    if (!bRead)
+        errno = ENOMEM;
+    while (bRead) {
         {
-            cerr << "NOFILE: (" << errno << ") Failed to extract '" << strFullPath << "' to " << strDestName << endl;
-        return 0;
+            tTraceSpan span(tracer, "read");
+            bRead = CascReadFile(hFile, buffer.data(), DWORD(buffer.size()), &read);
+        }
+        if (!bRead || read == 0)
+            break;
+        if (manifest.bEnabled) {
+            tTraceSpan span(tracer, "hash");
+            md5.update(buffer.data(), read);
+        }
+        tTraceSpan span(tracer, "write");
+        if (fwrite(buffer.data(), 1, read, dest) != read) {
+            bWritten = false;
+            break;
         }
+        fileSize += read;
+    }
+    buffer.release();
+
+    if (bRead && bWritten && !cacheHints.written(dest))
+        bWritten = false;
+
+    int error = errno;
+    {
+        tTraceSpan span(tracer, "close");
+        bWritten = (fclose(dest) == 0) && bWritten;
         CascCloseFile(hFile);
     }
-    else
+
+    if (!bRead || !bWritten)
     {
-        cerr << "NOARCHIVE: (" << errno << ") Failed to extract '" << strFullPath << "' to " << strDestName << endl;
-        return 0;
+        if (!bRead)
+            stats.readFailures++;
+        else
+            stats.writeFailures++;
+        progress.finish();
+        cerr << (bRead ? "NOWRITE" : "NOREAD") << ": (" << error << ") Failed to extract '" << szFullPath << "' to " << strDestName << endl;
+        return false;
+    }
+
+    if (manifest.bEnabled) {
+        unsigned char digest[MD5_DIGEST_SIZE];
+        md5.final(digest);
+        manifest.add(destPath.relativePath(), fileSize, digest);
+    }
+
+    stats.addFile(szFullPath, fileSize, stats.bEnabled ? tStats::wallClock() - startTime : 0);
+    return true;
+}
+
+/* Write LENGTH bytes of a file from OFFSET on to stdout, for --cat.
+ *
+ * CascSetFilePointer() goes straight to the frame holding the offset and
+ * CascReadFile() only decodes the frames it reads, so the first 64KB of a
+ * 120MB sound bank cost about as much as a 64KB file.  CascLib decodes into
+ * tPipeOutput's buffers, which go to stdout as they are: into a pipe with
+ * vmsplice(), so the only copy left is the one the reader makes.
+ *
+ * @return false if it could not be read or written, the reason is on stderr
+ */
+bool catFile(const char *szFullPath, unsigned long long offset, unsigned long long length) {
+    tTraceSpan span(tracer, "cat", szFullPath);
+
+    console.flush();
+    tPipeOutput output(fileno(stdout));
+    if (!output.isOpen()) {
+        cerr << "NOWRITE: (" << ENOMEM << ") Failed to allocate buffers for '" << szFullPath << "'" << endl;
+        return false;
+    }
+
+    HANDLE hFile;
+    if (!CascOpenFile(hStorage, szFullPath, CASC_LOCALE_ALL, 0, &hFile)) {
+        int error = errno;
+        stats.openFailures++;
+        cerr << "NOARCHIVE: (" << error << ") Failed to read '" << szFullPath << "'" << endl;
+        return false;
+    }
+
+    DWORD dwHigh = 0;
+    DWORD dwLow = CascGetFileSize(hFile, &dwHigh);
+    if (dwLow == CASC_INVALID_SIZE) {
+        int error = errno;
+        CascCloseFile(hFile);
+        stats.readFailures++;
+        cerr << "NOREAD: (" << error << ") Failed to read '" << szFullPath << "'" << endl;
+        return false;
+    }
+    unsigned long long fileSize = ((unsigned long long) dwHigh << 32) | dwLow;
+    unsigned long long remaining = (offset < fileSize) ? min(length, fileSize - offset) : 0;
+
+    bool bRead = true;
+    bool bWritten = true;
+    if (remaining) {
+        LONG high = LONG(offset >> 32);
+        bRead = CascSetFilePointer(hFile, LONG(offset & 0xFFFFFFFF), &high, FILE_BEGIN) != CASC_INVALID_POS;
+    }
+    while (bRead && bWritten && remaining) {
+        // Every buffer but the last one full, tPipeOutput relies on it
+        size_t wanted = size_t(min<unsigned long long>(output.capacity(), remaining));
+        size_t filled = 0;
+        while (filled < wanted) {
+            DWORD read = 0;
+            bRead = CascReadFile(hFile, output.buffer() + filled, DWORD(wanted - filled), &read);
+            if (!bRead || read == 0)
+                break;
+            filled += read;
+        }
+        if (filled == 0)
+            break;
+        bWritten = output.write(filled);
+        remaining = (filled < wanted) ? 0 : remaining - filled;
+        stats.bytesExtracted += filled;
     }
-    return fileSize;
+    int error = errno;
+    CascCloseFile(hFile);
+
+    if (!bRead) {
+        stats.readFailures++;
+        cerr << "NOREAD: (" << error << ") Failed to read '" << szFullPath << "'" << endl;
+        return false;
+    }
+    if (!bWritten) {
+        stats.writeFailures++;
+        cerr << "NOWRITE: (" << error << ") Failed to write '" << szFullPath << "' to stdout" << endl;
+        return false;
+    }
+    stats.filesExtracted++;
+    return true;
+}
+
+/* Parse "OFFSET:LENGTH", both sizes as parseSize() reads them.  "OFFSET"
+ * and "OFFSET:" run to the end of the file.
+ *
+ * @return false if the text is not a range
+ */
+bool parseRange(const char *szText, unsigned long long &offset, unsigned long long &length) {
+    const char *szColon = strchr(szText, ':');
+    string strOffset = szColon ? string(szText, szColon) : string(szText);
+    if (!parseSize(strOffset.c_str(), offset))
+        return false;
+    length = ~0ULL;
+    return !szColon || !szColon[1] || parseSize(szColon + 1, length);
+}
+
+/* Parse a thread count for -j, 0 meaning one per core.  atoi() would take
+ * "abc" (or "4x") for 0 or 4 without a word.
+ *
+ * @return false if the text is not a whole number from 0 to INT_MAX
+ */
+bool parseJobs(const char *szText, int &jobs) {
+    if (!isdigit((unsigned char) *szText))
+        return false;
+    char *szEnd = NULL;
+    errno = 0;
+    long value = strtol(szText, &szEnd, 10);
+    if (errno == ERANGE || *szEnd != 0 || value > INT_MAX)
+        return false;
+    jobs = int(value);
+    return true;
+}
+
+/* Compare the results with the files below strDestination, for --verify,
+ * and print the ones that do not match.  When extracting, only those are
+ * left in the results.
+ *
+ * @return How many did not match
+ */
+size_t verifyResults(tSearchResults &results) {
+    stats.beginPhase("verify");
+    tTraceSpan span(tracer, "verify");
+
+    echo("\nVerifying files in '" + strDestination + "':\n");
+    // Mostly waiting for the disk, so more threads than the filter by default
+    size_t nThreads = (bJobs && nJobs > 0) ? size_t(nJobs) : tWorkerPool::defaultThreads();
+    tVerifier verifier(hStorage, strDestination, bLowerCase);
+    vector<tVerifyStatus> statuses = verifier.verify(results.size(), [&results](size_t i) {
+        tVerifyFile file = { results.c_str(results[i]), results[i].fileSize, results[i].contentKey };
+        return file;
+    }, nThreads);
+
+    size_t counts[VERIFY_UNREADABLE + 1] = { 0 };
+    tSearchResults mismatches;
+    for (size_t i = 0; i < results.size(); ++i) {
+        counts[statuses[i]]++;
+        if (statuses[i] == VERIFY_OK)
+            continue;
+        char label[24];
+        snprintf(label, sizeof(label), "  %-13s ", tVerifier::describe(statuses[i]));
+        echo(label);
+        echo(string(results.c_str(results[i])) + "\n");
+        mismatches.add(results.match(results[i]));
+    }
+    stats.endPhase();
+
+    echo("  ");
+    echo(int(results.size() - mismatches.size()));
+    echo(" files match, ");
+    echo(int(counts[VERIFY_MISSING]));
+    echo(" missing, ");
+    echo(int(counts[VERIFY_TRUNCATED]));
+    echo(" truncated, ");
+    echo(int(counts[VERIFY_SIZE_DIFFERS] + counts[VERIFY_CONTENT_DIFFERS]));
+    echo(" differ, ");
+    echo(int(counts[VERIFY_UNREADABLE]));
+    echo(" unreadable.\n");
+
+    size_t filesMismatched = mismatches.size();
+    if (bExtract)
+        swap(results, mismatches);
+    return filesMismatched;
 }
 
 /** main()
@@ -369,10 +896,6 @@ int main(int argc, char** argv) {
     int filesFound = 0;
     int filesDone = 0;
 
-    vector<tSearchResult> searchResults;
-    std::set<string> directoryResults;
-    std::set<string>::iterator dIter;
-
     // Parse the command-line parameters
     CSimpleOpt args(argc, argv, COMMAND_LINE_OPTIONS);
     while (args.Next())
@@ -391,29 +914,133 @@ int main(int argc, char** argv) {
 
                 case OPT_DEST:
                     strDestination = args.OptionArg();
+                    bDestination = true;
                     break;
 
                 case OPT_SEARCH:
-                    strSearchPattern = args.OptionArg();
+                    searchFilter.strSearchPattern = args.OptionArg();
+                    break;
+
+                case OPT_PREFIX:
+                    searchFilter.strPrefix = args.OptionArg();
                     break;
 
                 case OPT_FILEPTRN:
-                    bPattern = true;
-                    strFilePattern = args.OptionArg();
+                    searchFilter.bPattern = true;
+                    searchFilter.strFilePattern = args.OptionArg();
                     break;
 
                 case OPT_FILEEXT:
-                    bFileExt = true;
-                    strFileExt = args.OptionArg();
+                    searchFilter.bFileExt = true;
+                    searchFilter.strFileExt = args.OptionArg();
                     break;
 
                 case OPT_FULLPATH:
                     bUseFullPath = true;
                     break;
 
-                // case OPT_LOWERCASE:
-                //     bLowerCase = true;
-                //     break;
+                case OPT_LOWERCASE:
+                    bLowerCase = true;
+                    break;
+
+                case OPT_STORAGEORDER:
+                    bStorageOrder = true;
+                    break;
+
+                case OPT_CACHEHINTS:
+                    bCacheHints = true;
+                    break;
+
+                case OPT_VERIFY:
+                    strVerify = args.OptionArg();
+                    break;
+
+                case OPT_MANIFEST:
+                    strManifest = args.OptionArg();
+                    manifest.bEnabled = true;
+                    break;
+
+                case OPT_CAT:
+                    strCatPath = args.OptionArg();
+                    break;
+
+                case OPT_RANGE:
+                    if (!parseRange(args.OptionArg(), nRangeOffset, nRangeLength)) {
+                        cerr << "Invalid range: " << args.OptionArg() << endl;
+                        return -1;
+                    }
+                    break;
+
+                case OPT_IGNORECASE:
+                    searchFilter.bIgnoreCase = true;
+                    break;
+
+                case OPT_MINSIZE:
+                    if (!parseSize(args.OptionArg(), searchFilter.nMinSize)) {
+                        cerr << "Invalid size: " << args.OptionArg() << endl;
+                        return -1;
+                    }
+                    break;
+
+                case OPT_MAXSIZE:
+                    if (!parseSize(args.OptionArg(), searchFilter.nMaxSize)) {
+                        cerr << "Invalid size: " << args.OptionArg() << endl;
+                        return -1;
+                    }
+                    break;
+
+                case OPT_SORT:
+                    if (string(args.OptionArg()) == "name") {
+                        sortOrder = SORT_NAME;
+                    } else if (string(args.OptionArg()) == "size") {
+                        sortOrder = SORT_SIZE;
+                    } else {
+                        cerr << "Invalid sort order: " << args.OptionArg() << endl;
+                        return -1;
+                    }
+                    break;
+
+                case OPT_FORMAT:
+                    if (string(args.OptionArg()) == "text") {
+                        outputFormat = FORMAT_TEXT;
+                    } else if (string(args.OptionArg()) == "null") {
+                        outputFormat = FORMAT_NULL;
+                    } else if (string(args.OptionArg()) == "jsonl") {
+                        outputFormat = FORMAT_JSONL;
+                    } else if (string(args.OptionArg()) == "tsv") {
+                        outputFormat = FORMAT_TSV;
+                    } else {
+                        cerr << "Invalid format: " << args.OptionArg() << endl;
+                        return -1;
+                    }
+                    break;
+
+                case OPT_EXPORTTABLE:
+                    strExportTable = args.OptionArg();
+                    break;
+
+                case OPT_TABLE:
+                    if (!fileTable.open(args.OptionArg())) {
+                        cerr << "Failed to load the table '" << args.OptionArg() << "'" << endl;
+                        return -1;
+                    }
+                    break;
+
+                case OPT_STATS:
+                    stats.bEnabled = true;
+                    break;
+
+                case OPT_STATSJSON:
+                    stats.bEnabled = true;
+                    strStatsJson = args.OptionArg();
+                    break;
+
+                case OPT_TRACE:
+                    if (!tracer.open(args.OptionArg())) {
+                        cerr << "Failed to create the trace '" << args.OptionArg() << "'" << endl;
+                        return -1;
+                    }
+                    break;
 
                 case OPT_QUIET:
                     bQuiet = true;
@@ -427,9 +1054,22 @@ int main(int argc, char** argv) {
                     bExtract = true;
                     break;
 
-                // case OPT_LISTDIRS:
-                //     bDirectories = true;
-                //     break;
+                case OPT_JOBS:
+                    bJobs = true;
+                    if (!parseJobs(args.OptionArg(), nJobs)) {
+                        cerr << "Invalid number of jobs: " << args.OptionArg() << endl;
+                        return -1;
+                    }
+                    break;
+
+                case OPT_LISTDIRS:
+                    bDirectories = true;
+                    break;
+
+                case OPT_DISKUSAGE:
+                    bDirectories = true;
+                    bDiskUsage = true;
+                    break;
 
                 // case OPT_REGEX:
                 //     bSearchPattern = true;
@@ -445,72 +1085,305 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (bDirectories && !strExportTable.empty()) {
+        cerr << "--export-table saves files, it cannot be combined with -d" << endl;
+        return -1;
+    }
+
+    if (manifest.bEnabled && (!bExtract || bDirectories)) {
+        cerr << "--manifest lists extracted files, it needs -x (and no -d)" << endl;
+        return -1;
+    }
+
+    // Repairing a tree means extracting into it
+    bool bVerify = !strVerify.empty();
+    if (bVerify) {
+        if (bDirectories || !strCatPath.empty() || outputFormat != FORMAT_TEXT) {
+            cerr << "--verify checks files, it cannot be combined with -d, --cat or --format" << endl;
+            return -1;
+        }
+        if (bDestination) {
+            cerr << "--verify extracts into the PATH it checks, it cannot be combined with -o" << endl;
+            return -1;
+        }
+        if (manifest.bEnabled) {
+            cerr << "--manifest would only list the files --verify -x extracts again, not the whole tree" << endl;
+            return -1;
+        }
+        strDestination = strVerify;
+    }
+
+    if (!strCatPath.empty()) {
+        if (bExtract || bDirectories || !strExportTable.empty()) {
+            cerr << "--cat prints one file, it cannot be combined with -x, -d or --export-table" << endl;
+            return -1;
+        }
+        bQuiet = true;
+    } else if (nRangeOffset != 0 || nRangeLength != ~0ULL) {
+        cerr << "--range only applies to --cat" << endl;
+        return -1;
+    }
+
+    // Keep stdout for the listing alone when a program reads it
+    if (outputFormat != FORMAT_TEXT) {
+        if (bDirectories) {
+            cerr << "--format only applies to file listings, not to -d" << endl;
+            return -1;
+        }
+        bQuiet = true;
+    }
+
+    // A progress line is only drawn in place of the verbose log
+    if (bQuiet || bVerbose)
+        progress.disable();
+
     // Remove trailing slashes at the end of the storage path (CascLib doesn't like that)
     if ((strSource[strSource.size() - 1] == '/') || (strSource[strSource.size() - 1] == '\\'))
         strSource = strSource.substr(0, strSource.size() - 1);
 
-    // Open CASC Files
-    if (!CascOpenStorage(strSource.c_str(), 0, &hStorage)) {
-        cerr << "Failed to open the storage '" << strSource << "'" << endl;
-        return -2;
+    // Open CASC Files, a table is enough unless files are read
+    if (!fileTable.isOpen() || bExtract || bVerify || !strCatPath.empty()) {
+        stats.beginPhase("open storage");
+        tTraceSpan span(tracer, "open storage");
+        if (!CascOpenStorage(strSource.c_str(), 0, &hStorage)) {
+            cerr << "Failed to open the storage '" << strSource << "'" << endl;
+            return -2;
+        }
+        stats.endPhase();
+    }
+
+    if (!strCatPath.empty()) {
+        stats.beginPhase("cat");
+        bool bPrinted = catFile(strCatPath.c_str(), nRangeOffset, nRangeLength);
+        stats.endPhase();
+        CascCloseStorage(hStorage);
+        tracer.close();
+        if (stats.bEnabled)
+            stats.print(stderr);
+        return bPrinted ? 0 : -3;
     }
 
+    if (bExtract && (bStorageOrder || bCacheHints) && !canLocateFiles()) {
+        verbose("This CascLib does not tell where files are stored, --storage-order and --cache-hints are off\n");
+        bStorageOrder = false;
+        bCacheHints = false;
+    }
+    if (bExtract && bCacheHints && !cacheHints.open(strSource)) {
+        verbose("No data archives to give hints about, --cache-hints is off\n");
+    }
+
+    // Extraction needs the whole list first to plan its order or hints
+    bool bPlan = bExtract && (bStorageOrder || cacheHints.isEnabled());
+
     // Explain what we want to do
-    echo("Searching for files: \n");
-    verbose("  * full paths matching '" + strSearchPattern + "'\n");
-    if (bPattern) {
-        verbose("  * filenames matching '" + strFilePattern + "'\n");
+    if (bExtract && sortOrder == SORT_NONE && strExportTable.empty() && !bPlan && !bVerify && !bDirectories) {
+        echo("Searching for and extracting files: \n");
+    } else {
+        echo("Searching for files: \n");
+    }
+    if (!searchFilter.strPrefix.empty()) {
+        verbose("  * full paths starting with '" + searchFilter.strPrefix + "'\n");
     }
-    if (bFileExt) {
-        verbose("  * extensions matching '" + strFileExt + "'\n");
+    verbose("  * full paths matching '" + searchFilter.strSearchPattern + "'\n");
+    if (searchFilter.bPattern) {
+        verbose("  * filenames matching '" + searchFilter.strFilePattern + "'\n");
     }
-    if (bFileExt || bPattern) {
-        verbose();
+    if (searchFilter.bFileExt) {
+        verbose("  * extensions matching '" + searchFilter.strFileExt + "'\n");
     }
+    if (searchFilter.nMinSize > 0) {
+        verbose("  * at least " + to_string(searchFilter.nMinSize) + " bytes\n");
+    }
+    if (searchFilter.nMaxSize != ~0ULL) {
+        verbose("  * at most " + to_string(searchFilter.nMaxSize) + " bytes\n");
+    }
+    if (!fileTable.isOpen()) {
+        verbose("  * storage mask '" + searchFilter.findMask() + "'\n");
+    }
+    verbose();
+
+    if (strDestination.at(strDestination.size() - 1) != '/')
+        strDestination += "/";
+    destPath.setRoot(strDestination);
 
     // Search
-    vector<string> results = searchArchive();
-    filesFound = results.size();
-    echo("  ");
+    tSearchResults results;
+    if ( bDirectories ) {
+        stats.beginPhase("search");
+        filesFound = int(searchArchive([](const tSearchMatch &match) {
+            directoryTree.addFile(match.szFullPath, match.nFullPath - match.nPlainName, match.fileSize);
+            return true;
+        }));
+        stats.endSearchPhase();
+    } else if (sortOrder != SORT_NONE || !strExportTable.empty() || bPlan || bVerify) {
+        stats.beginPhase("search");
+        results = collectResults();
+        filesFound = results.size();
+        stats.endSearchPhase();
+
+        // A table is always sorted by path, whatever the listing order
+        if (!strExportTable.empty()) {
+            stats.beginPhase("sort");
+            {
+                tTraceSpan span(tracer, "sort");
+                results.sort(compareByName);
+            }
+            stats.beginPhase("export");
+            tTraceSpan span(tracer, "export");
+            if (!writeTable(strExportTable.c_str(), results)) {
+                cerr << "Failed to write the table '" << strExportTable << "'" << endl;
+                return -4;
+            }
+        }
+        // Saving the table already left the results in name order
+        if (sortOrder == SORT_SIZE || (sortOrder == SORT_NAME && strExportTable.empty())) {
+            stats.beginPhase("sort");
+            tTraceSpan span(tracer, "sort");
+            sortResults(results);
+        }
+
+        // --verify reports the files that differ instead
+        if (!bVerify) {
+            stats.beginPhase("list");
+            for (size_t i = 0; i < results.size(); ++i) {
+                listMatch(results.match(results[i]));
+            }
+            stats.endPhase();
+        }
+    } else {
+        // Print each match as it is found and, when extracting, extract it
+        // right away while the enumeration carries on.
+        size_t nSeen = 0;
+        stats.beginPhase(bExtract ? "search + extract" : "search");
+        filesFound = int(searchArchive([&filesDone, &nSeen](const tSearchMatch &match) {
+            listMatch(match);
+            if (bExtract) {
+                progress.update(++nSeen, 0, match.szFullPath);
+                if (extractFile(match.szFullPath)) {
+                    filesDone++;
+                }
+            }
+            return true;
+        }));
+        stats.endSearchPhase();
+        progress.finish();
+    }
+
+    if ( bDirectories ) {
+        tDirectoryPrinter printer;
+        if (bDiskUsage) {
+            echo("           bytes     files  directory\n");
+        }
+        directoryTree.visit(printer);
+
+        const tPathTrie::tNode &root = directoryTree.root();
+        echo("  ");
+        echo(int(directoryTree.size()));
+        echo(" directories, ");
+        echo(to_string(root.totalBytes));
+        echo(" bytes in ");
+    } else {
+        echo("  ");
+    }
     echo(filesFound);
     echo(" files found.\n");
+    if (!strExportTable.empty()) {
+        echo("  Table saved to '" + strExportTable + "'.\n");
+    }
 
-    // if ( bDirectories ) {
-    //    for (dIter=directoryResults.begin(); dIter!=directoryResults.end(); ++dIter)
-    //        std::cout << ' ' << *dIter << endl;
-    //    std::cout << '\n';
-    // }
+    size_t filesMismatched = 0;
+    if (bVerify) {
+        filesMismatched = verifyResults(results);
+    }
 
-    // Extraction
+    // Extraction of a sorted list, the streamed one is already done
     if (bExtract && !results.empty())
     {
         verbose("\n");
-        int progress;
         echo("Extracting files:\n");
 
-        if (strDestination.at(strDestination.size() - 1) != '/')
-            strDestination += "/";
+        // The listing order, unless asked to follow the archives
+        vector<tStorageLocation> plan;
+        if (bPlan) {
+            stats.beginPhase("plan");
+            tTraceSpan span(tracer, "plan");
+            plan = locateFiles(hStorage, results.size(), [&results](size_t i) {
+                return results.c_str(results[i]);
+            });
+            if (bStorageOrder)
+                sortByStorage(plan);
+            cacheHints.plan(plan, [&results](size_t i) {
+                return results[i].fileSize;
+            });
+        }
+        stats.beginPhase("extract");
 
-        vector<string>::iterator iter, iterEnd;
-        for (iter = results.begin(), iterEnd = results.end(); iter != iterEnd; ++iter)
+        for (size_t i = 0; i < results.size(); ++i)
         {
-            progress = int(filesDone * 100 / filesFound);
-            printProgress(progress, iter->c_str());
-            size_t bytesWritten = extractFile(iter->c_str());
-            if (bytesWritten > 0) {
+            cacheHints.reading(i);
+            const char *szFullPath = results.c_str(results[plan.empty() ? i : plan[i].index]);
+            if (bVerbose) {
+                char line[16];
+                snprintf(line, sizeof(line), "  %6d%% ", int(i * 100 / results.size()));
+                verbose(line);
+                verbose(szFullPath);
+            } else {
+                progress.update(i, results.size(), szFullPath);
+            }
+            if (extractFile(szFullPath)) {
               filesDone++;
             }
+            cacheHints.read(i);
             verbose(" ...done!\n");
         }
+        cacheHints.finish();
+        stats.endPhase();
+        progress.finish();
         verbose("\n");
+    }
+
+    if (bExtract && !bDirectories) {
         echo("  ");
         echo(filesDone);
         echo(" files extracted.\n");
     }
 
-    CascCloseStorage(hStorage);
+    // Still close everything and print the statistics if it fails
+    bool bManifestWritten = true;
+    if (manifest.bEnabled) {
+        stats.beginPhase("manifest");
+        tTraceSpan span(tracer, "manifest");
+        bManifestWritten = manifest.write(strManifest.c_str());
+        if (!bManifestWritten) {
+            int error = errno;
+            console.flush();
+            cerr << "NOWRITE: (" << error << ") Failed to write the manifest to '" << strManifest << "'" << endl;
+        } else {
+            echo("  Manifest saved to '" + strManifest + "'.\n");
+        }
+        stats.endPhase();
+    }
+
+    if (hStorage)
+        CascCloseStorage(hStorage);
     echo();
-    return 0;
+    console.flush();
+
+    if (!tracer.close()) {
+        cerr << "Failed to write the trace" << endl;
+    }
+
+    if (stats.bEnabled) {
+        stats.filesFound = filesFound;
+        stats.print(stderr);
+        if (!strStatsJson.empty() && !stats.writeJson(strStatsJson.c_str())) {
+            cerr << "Failed to write the statistics to '" << strStatsJson << "'" << endl;
+            return -4;
+        }
+    }
+    if (!bManifestWritten)
+        return -4;
+    return (filesMismatched && !bExtract) ? -5 : 0;
 }
 
 #if NODE
@@ -537,50 +1410,130 @@ void nodeGetVersion(const Nan::FunctionCallbackInfo<v8::Value> &args) {
 }
 
 
+/* A JavaScript number as a size.  Casting NaN, a negative number or one past
+ * the largest size is undefined, so those are for the caller to turn down;
+ * Infinity, and anything else too large, is the largest size.
+ *
+ * @return false if it is NaN or negative
+ */
+bool nodeToSize(double number, unsigned long long &nValue) {
+    if (!(number >= 0))
+        return false;
+    nValue = (number >= 18446744073709551616.0) ? ~0ULL : (unsigned long long) number;
+    return true;
+}
+
+/* Read a numeric property of an options object, if it is set, as a size.
+ *
+ * @return false if it is set but not a size, the reason is on stderr
+ */
+bool nodeGetNumber(v8::Handle<v8::Object> options, const char *szName, unsigned long long &nValue) {
+    v8::Handle<v8::Value> value = options->Get(Nan::New(szName).ToLocalChecked());
+    if (!value->IsNumber())
+        return true;
+    if (!nodeToSize(value->NumberValue(), nValue)) {
+        cerr << "Invalid size for " << szName << ": " << value->NumberValue() << endl;
+        return false;
+    }
+    return true;
+}
+
+/* The storage stays open between calls, so a long-lived process pays for
+ * opening it once.  Blocks read through the cache stay valid as long as it
+ * is the same storage.
+ */
+string strOpenSource;       // What hStorage is, empty if nothing is open
+tBlockCache blockCache;
+
+void nodeCloseStorage() {
+    if (hStorage)
+        CascCloseStorage(hStorage);
+    hStorage = NULL;
+    strOpenSource.clear();
+    blockCache.clear();
+}
+
+/* Open the storage a call names, unless it is open already.
+ *
+ * @return false if it could not be opened, the reason is on stderr
+ */
+bool nodeOpenStorage(v8::Handle<v8::Value> source) {
+    strSource = *v8::String::Utf8Value(source->ToString());
+    if (!strSource.empty() && ((strSource[strSource.size() - 1] == '/') || (strSource[strSource.size() - 1] == '\\')))
+        strSource = strSource.substr(0, strSource.size() - 1);
+
+    if (hStorage && strSource == strOpenSource)
+        return true;
+
+    nodeCloseStorage();
+    if (!CascOpenStorage(strSource.c_str(), 0, &hStorage)) {
+        hStorage = NULL;
+        cerr << "Failed to open the storage '" << strSource << "'" << endl;
+        return false;
+    }
+    strOpenSource = strSource;
+    return true;
+}
+
 /* List all files in a CASC archive.
  *
  * @param (string) Source directory of CASC files
+ * @param (object) Optional: { prefix, minSize, maxSize, sort: 'name'|'size' }
  * @return (array) Full paths of files in the archive
  */
 void nodeListFiles(const Nan::FunctionCallbackInfo<v8::Value> &args) {
     // Set API variables
     bQuiet = true;
     bVerbose = false;
+    searchFilter = tSearchFilter();
+    sortOrder = SORT_NONE;
+
+    if (args.Length() > 1 && args[1]->IsObject()) {
+        v8::Handle<v8::Object> options = args[1]->ToObject();
+        v8::Handle<v8::Value> prefix = options->Get(Nan::New("prefix").ToLocalChecked());
+        if (prefix->IsString())
+            searchFilter.strPrefix = *v8::String::Utf8Value(prefix);
+        if (!nodeGetNumber(options, "minSize", searchFilter.nMinSize) ||
+            !nodeGetNumber(options, "maxSize", searchFilter.nMaxSize)) {
+            return;
+        }
+
+        string strSort = *v8::String::Utf8Value(options->Get(Nan::New("sort").ToLocalChecked())->ToString());
+        if (strSort == "name")
+            sortOrder = SORT_NAME;
+        else if (strSort == "size")
+            sortOrder = SORT_SIZE;
+    }
 
     // Allocate a new scope when we create v8 JavaScript objects.
     v8::Isolate *isolate = args.GetIsolate();
     Nan::HandleScope scope;
 
-    strSource = *v8::String::Utf8Value(args[0]->ToString());
-
-    if ((strSource[strSource.size() - 1] == '/') || (strSource[strSource.size() - 1] == '\\'))
-        strSource = strSource.substr(0, strSource.size() - 1);
-
-    if (!CascOpenStorage(strSource.c_str(), 0, &hStorage)) {
-        cerr << "Failed to open the storage '" << strSource << "'" << endl;
+    if (!nodeOpenStorage(args[0])) {
         return;
     }
 
-    // Define variables
-    CASC_FIND_DATA findData;
-    HANDLE handle = CascFindFirstFile(hStorage, "*", &findData, NULL);
-
     // Let's get this party started..
-    vector<string> results = searchArchive();
-
-    // Convert returned vector of *chars to a v8::Array of v8::Strings
     v8::Handle<v8::Array> files = v8::Array::New(isolate);
-    for (unsigned int i = 0; i < results.size(); i++ ) {
-      v8::Handle<v8::String> result = v8::String::NewFromUtf8(isolate, results[i].c_str());
-      files->Set(i, result);
+    if (sortOrder == SORT_NONE) {
+        // Fill the v8::Array as the matches come in
+        uint32_t count = 0;
+        searchArchive([&](const tSearchMatch &match) {
+            files->Set(count++, v8::String::NewFromUtf8(isolate, match.szFullPath, v8::String::kNormalString, int(match.nFullPath)));
+            return true;
+        });
+    } else {
+        tSearchResults results = collectResults();
+        sortResults(results);
+
+        // Convert the packed results to a v8::Array of v8::Strings
+        for (unsigned int i = 0; i < results.size(); i++ ) {
+          tStringRef path = results.path(results[i]);
+          v8::Handle<v8::String> result = v8::String::NewFromUtf8(isolate, path.data, v8::String::kNormalString, int(path.size));
+          files->Set(i, result);
+        }
     }
 
-    // Clean it up...
-    CascFindClose(handle);
-    CascCloseStorage(hStorage);
-    handle = NULL;
-    hStorage = NULL;
-
     // Ship it out...
     args.GetReturnValue().Set(files);
     return;
@@ -592,6 +1545,8 @@ void nodeListFiles(const Nan::FunctionCallbackInfo<v8::Value> &args) {
  * @param (string) Source directory of CASC archive
  * @param (string) Destination directory to extract files
  * @param (array) Array of files within the CASC archive
+ * @param (object) Optional: { storageOrder: true } extracts them in the order
+ *                 they are stored instead of the array's
  * @return (int) Number of files successfully extracted.
  */
 void nodeExtractFiles(const Nan::FunctionCallbackInfo<v8::Value> &args) {
@@ -599,19 +1554,14 @@ void nodeExtractFiles(const Nan::FunctionCallbackInfo<v8::Value> &args) {
     v8::Isolate *isolate = args.GetIsolate();
     Nan::HandleScope scope;
 
-    // strSource
-    strSource = *v8::String::Utf8Value(args[0]->ToString());
-    if ((strSource[strSource.size() - 1] == '/') || (strSource[strSource.size() - 1] == '\\'))
-        strSource = strSource.substr(0, strSource.size() - 1);
-
     // strDestination
     strDestination = *v8::String::Utf8Value(args[1]->ToString());
     if (strDestination.at(strDestination.size() - 1) != '/')
         strDestination += "/";
+    destPath.setRoot(strDestination);
 
     // Open CASC archive
-    if (!CascOpenStorage(strSource.c_str(), 0, &hStorage)) {
-        cerr << "Failed to open the storage '" << strSource << "'" << endl;
+    if (!nodeOpenStorage(args[0])) {
         args.GetReturnValue().Set(-1);
         return;
     }
@@ -620,30 +1570,146 @@ void nodeExtractFiles(const Nan::FunctionCallbackInfo<v8::Value> &args) {
 
     if (args[2]->IsArray()) {
         v8::Handle<v8::Array> files = v8::Handle<v8::Array>::Cast(args[2]);
+        vector<string> paths;
         for (uint32_t i = 0; i < files->Length(); i++) {
             v8::String::Utf8Value item(files->Get(i)->ToString());
-            std::basic_string<char> file = std::string(*item);
-            size_t bytesWritten = extractFile(file);
-            if (bytesWritten > 0) {
+            paths.push_back(std::string(*item));
+        }
+
+        // Only the count goes back, so the files may be read in storage order
+        bool bOrdered = false;
+        if (args.Length() > 3 && args[3]->IsObject()) {
+            v8::Handle<v8::Object> options = args[3]->ToObject();
+            bOrdered = options->Get(Nan::New("storageOrder").ToLocalChecked())->BooleanValue();
+        }
+
+        vector<tStorageLocation> plan;
+        if (bOrdered) {
+            plan = planStorageOrder(hStorage, paths.size(), [&paths](size_t i) {
+                return paths[i].c_str();
+            });
+        }
+        for (size_t i = 0; i < paths.size(); i++) {
+            if (extractFile(paths[plan.empty() ? i : plan[i].index].c_str())) {
               filesDone++;
             }
         }
     }
 
-    // Clean it up...
-    CascCloseStorage(hStorage);
-    hStorage = NULL;
-
     // Ship it out...
     args.GetReturnValue().Set(filesDone);
     return;
 }
 
+/* Read a whole file into memory, through the block cache.
+ *
+ * Meant for small files read over and over, such as GameData.xml; large
+ * ones are better extracted.
+ * @param (string) Source directory of CASC archive
+ * @param (string) Full path of the file within the CASC archive
+ * @return (Buffer) The contents, or undefined if it could not be read
+ */
+void nodeReadFile(const Nan::FunctionCallbackInfo<v8::Value> &args) {
+    Nan::HandleScope scope;
+
+    if (!nodeOpenStorage(args[0])) {
+        return;
+    }
+
+    string strPath = *v8::String::Utf8Value(args[1]->ToString());
+    vector<char> contents;
+    tCachedFile file(blockCache, hStorage, strPath.c_str(), NULL);
+    if (!file.readAll(contents)) {
+        cerr << "NOREAD: Failed to read '" << strPath << "'" << endl;
+        return;
+    }
+
+    args.GetReturnValue().Set(Nan::CopyBuffer(contents.data(), uint32_t(contents.size())).ToLocalChecked());
+}
+
+/* Read part of a file into memory, through the block cache.
+ *
+ * Only the blocks covering the range are decompressed, or taken from the
+ * cache, so a header can be read out of a large file cheaply.
+ * @param (string) Source directory of CASC archive
+ * @param (string) Full path of the file within the CASC archive
+ * @param (number) Offset of the first byte
+ * @param (number) How many bytes, fewer at the end of the file (default, or Infinity: to the end)
+ * @return (Buffer) The bytes, or undefined if the file could not be read
+ */
+void nodeRead(const Nan::FunctionCallbackInfo<v8::Value> &args) {
+    Nan::HandleScope scope;
+
+    if (!nodeOpenStorage(args[0])) {
+        return;
+    }
+
+    string strPath = *v8::String::Utf8Value(args[1]->ToString());
+    // A negative (or NaN) offset starts at 0, a negative length runs to the end
+    unsigned long long offset = 0;
+    unsigned long long length = ~0ULL;
+    if (args[2]->IsNumber() && !nodeToSize(args[2]->NumberValue(), offset))
+        offset = 0;
+    if (args[3]->IsNumber() && !nodeToSize(args[3]->NumberValue(), length))
+        length = ~0ULL;
+    vector<char> contents;
+    tCachedFile file(blockCache, hStorage, strPath.c_str(), NULL);
+    if (!file.read(offset, length, contents)) {
+        cerr << "NOREAD: Failed to read '" << strPath << "'" << endl;
+        return;
+    }
+
+    args.GetReturnValue().Set(Nan::CopyBuffer(contents.data(), uint32_t(contents.size())).ToLocalChecked());
+}
+
+/* Set how many bytes of decompressed blocks readFile() and read() keep.
+ *
+ * @param (number) The budget in bytes, 0 (the default) turns the cache off;
+ *                 Infinity keeps everything; a negative one is refused
+ */
+void nodeSetCacheSize(const Nan::FunctionCallbackInfo<v8::Value> &args) {
+    unsigned long long nBudget = 0;
+    if (args[0]->IsNumber() && !nodeToSize(args[0]->NumberValue(), nBudget)) {
+        cerr << "Invalid cache size: " << args[0]->NumberValue() << endl;
+        return;
+    }
+    blockCache.setBudget(size_t(min<unsigned long long>(nBudget, size_t(-1))));
+}
+
+/* Block cache counters.
+ *
+ * @return (object) { hits, misses, evictions, bytes, blocks, budget }
+ */
+void nodeGetCacheStats(const Nan::FunctionCallbackInfo<v8::Value> &args) {
+    Nan::HandleScope scope;
+
+    tBlockCache::tCounters counters = blockCache.counters();
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+    Nan::Set(result, Nan::New("hits").ToLocalChecked(), Nan::New<v8::Number>(double(counters.hits)));
+    Nan::Set(result, Nan::New("misses").ToLocalChecked(), Nan::New<v8::Number>(double(counters.misses)));
+    Nan::Set(result, Nan::New("evictions").ToLocalChecked(), Nan::New<v8::Number>(double(counters.evictions)));
+    Nan::Set(result, Nan::New("bytes").ToLocalChecked(), Nan::New<v8::Number>(double(counters.bytes)));
+    Nan::Set(result, Nan::New("blocks").ToLocalChecked(), Nan::New<v8::Number>(double(counters.blocks)));
+    Nan::Set(result, Nan::New("budget").ToLocalChecked(), Nan::New<v8::Number>(double(counters.budget)));
+    args.GetReturnValue().Set(result);
+}
+
+/* Close the storage kept open between calls, and empty the cache.
+ */
+void nodeClose(const Nan::FunctionCallbackInfo<v8::Value> &args) {
+    nodeCloseStorage();
+}
+
 /* Initialize and Register to Node */
 void init(v8::Handle<v8::Object> exports) {
     Nan::Export(exports, "listFiles", nodeListFiles);
     Nan::Export(exports, "extractFiles", nodeExtractFiles);
     Nan::Export(exports, "getVersion", nodeGetVersion);
+    Nan::Export(exports, "readFile", nodeReadFile);
+    Nan::Export(exports, "read", nodeRead);
+    Nan::Export(exports, "setCacheSize", nodeSetCacheSize);
+    Nan::Export(exports, "getCacheStats", nodeGetCacheStats);
+    Nan::Export(exports, "close", nodeClose);
 }
 
 NODE_MODULE(StormExtractLib, init);
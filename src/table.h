@@ -0,0 +1,291 @@
+/*****************************************************************************/
+/* table.h                                   Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* the file table saved as a columnar binary file, and mapped back in        */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_TABLE_H
+#define STORMEXTRACT_TABLE_H
+
+#include "output.h"
+#include "results.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+/* File layout, little-endian, every column starting on an 8 byte boundary:
+ *
+ *   tTableHeader
+ *   uint64_t  pathOffsets[rowCount + 1]     into the heap, the last one ends it
+ *   uint32_t  plainOffsets[rowCount]        from the start of the full path
+ *   uint64_t  sizes[rowCount]
+ *   uint8_t   keys[rowCount][16]            content keys, zero when unknown
+ *   uint32_t  locales[rowCount]             CASC_LOCALE_* flags
+ *   char      heap[heapSize]                full paths, each NUL terminated
+ *
+ * Rows are sorted byte-wise by full path, so a prefix is one binary search
+ * away.  Other tools can map the file and index the columns directly.
+ */
+struct tTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t rowCount;
+    uint64_t heapSize;
+    uint64_t pathOffsets;           // File offset of each column
+    uint64_t plainOffsets;
+    uint64_t sizes;
+    uint64_t keys;
+    uint64_t locales;
+    uint64_t heap;
+};
+
+static const char TABLE_MAGIC[8] = { 'S', 'T', 'O', 'R', 'M', 'T', 'B', 'L' };
+static const uint32_t TABLE_VERSION = 1;
+
+inline uint64_t alignTableOffset(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+/* Write search results as a table.
+ *
+ * The results must already be sorted by full path (see comparePaths()).
+ *
+ * @return false if the file could not be written
+ */
+inline bool writeTable(const char *szFileName, const tSearchResults &results) {
+    FILE *file = fopen(szFileName, "wb");
+    if (!file)
+        return false;
+
+    uint64_t rowCount = results.size();
+    uint64_t heapSize = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+        heapSize += results[i].pathLength + 1;
+
+    tTableHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TABLE_MAGIC, sizeof(header.magic));
+    header.version = TABLE_VERSION;
+    header.rowCount = rowCount;
+    header.heapSize = heapSize;
+    header.pathOffsets = alignTableOffset(sizeof(header));
+    header.plainOffsets = alignTableOffset(header.pathOffsets + (rowCount + 1) * sizeof(uint64_t));
+    header.sizes = alignTableOffset(header.plainOffsets + rowCount * sizeof(uint32_t));
+    header.keys = alignTableOffset(header.sizes + rowCount * sizeof(uint64_t));
+    header.locales = alignTableOffset(header.keys + rowCount * CONTENT_KEY_SIZE);
+    header.heap = alignTableOffset(header.locales + rowCount * sizeof(uint32_t));
+
+    {
+        tOutput out(file);
+        uint64_t position = 0;
+        const char padding[8] = { 0 };
+
+        // Pads up to where the next column starts
+        auto startColumn = [&out, &position, &padding](uint64_t offset) {
+            out.write(padding, size_t(offset - position));
+            position = offset;
+        };
+
+        out.write((const char *) &header, sizeof(header));
+        position = sizeof(header);
+
+        startColumn(header.pathOffsets);
+        uint64_t pathOffset = 0;
+        for (size_t i = 0; i <= results.size(); ++i) {
+            out.write((const char *) &pathOffset, sizeof(pathOffset));
+            if (i < results.size())
+                pathOffset += results[i].pathLength + 1;
+        }
+        position += (rowCount + 1) * sizeof(uint64_t);
+
+        startColumn(header.plainOffsets);
+        for (size_t i = 0; i < results.size(); ++i) {
+            uint32_t plainOffset = results[i].plainOffset;
+            out.write((const char *) &plainOffset, sizeof(plainOffset));
+        }
+        position += rowCount * sizeof(uint32_t);
+
+        startColumn(header.sizes);
+        for (size_t i = 0; i < results.size(); ++i) {
+            uint64_t fileSize = results[i].fileSize;
+            out.write((const char *) &fileSize, sizeof(fileSize));
+        }
+        position += rowCount * sizeof(uint64_t);
+
+        startColumn(header.keys);
+        for (size_t i = 0; i < results.size(); ++i)
+            out.write((const char *) results[i].contentKey, CONTENT_KEY_SIZE);
+        position += rowCount * CONTENT_KEY_SIZE;
+
+        startColumn(header.locales);
+        for (size_t i = 0; i < results.size(); ++i) {
+            uint32_t localeFlags = results[i].localeFlags;
+            out.write((const char *) &localeFlags, sizeof(localeFlags));
+        }
+        position += rowCount * sizeof(uint32_t);
+
+        startColumn(header.heap);
+        for (size_t i = 0; i < results.size(); ++i)
+            out.write(results.c_str(results[i]), results[i].pathLength + 1);
+    }
+
+    bool bWritten = !ferror(file);
+    return (fclose(file) == 0) && bWritten;
+}
+
+/* A table file mapped into memory.
+ *
+ * Opening checks the header and every path offset once, after that rows
+ * are read straight from the mapping without any copy.
+ */
+class tFileTable {
+public:
+    tFileTable() : data(NULL), length(0), header(NULL) {
+    }
+
+    ~tFileTable() {
+        close();
+    }
+
+    /* Map a table written by writeTable().
+     *
+     * @return false if the file cannot be read or is not a valid table
+     */
+    bool open(const char *szFileName) {
+        close();
+
+        int fd = ::open(szFileName, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(tTableHeader)) {
+            ::close(fd);
+            return false;
+        }
+
+        void *mapping = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        data = (const char *) mapping;
+        length = size_t(st.st_size);
+        header = (const tTableHeader *) data;
+        if (!validate()) {
+            close();
+            return false;
+        }
+
+        pathOffsets = (const uint64_t *) (data + header->pathOffsets);
+        plainOffsets = (const uint32_t *) (data + header->plainOffsets);
+        sizes = (const uint64_t *) (data + header->sizes);
+        keys = (const unsigned char *) (data + header->keys);
+        locales = (const uint32_t *) (data + header->locales);
+        heap = data + header->heap;
+        return true;
+    }
+
+    void close() {
+        if (data)
+            munmap((void *) data, length);
+        data = NULL;
+        length = 0;
+        header = NULL;
+    }
+
+    bool isOpen() const {
+        return data != NULL;
+    }
+
+    size_t size() const {
+        return header ? size_t(header->rowCount) : 0;
+    }
+
+    // Bytes of all the paths, NULs included
+    size_t heapSize() const {
+        return header ? size_t(header->heapSize) : 0;
+    }
+
+    tSearchMatch row(size_t i) const {
+        size_t nFullPath = size_t(pathOffsets[i + 1] - pathOffsets[i] - 1);
+        tSearchMatch ret = { heap + pathOffsets[i], nFullPath, heap + pathOffsets[i] + plainOffsets[i],
+                             nFullPath - plainOffsets[i], sizes[i], keys + i * CONTENT_KEY_SIZE, locales[i] };
+        return ret;
+    }
+
+    // The first row whose full path is not less than szPrefix
+    size_t lowerBound(const char *szPrefix, size_t nPrefix) const {
+        size_t first = 0, count = size();
+        while (count > 0) {
+            size_t step = count / 2;
+            size_t i = first + step;
+            size_t nFullPath = size_t(pathOffsets[i + 1] - pathOffsets[i] - 1);
+            int cmp = memcmp(heap + pathOffsets[i], szPrefix, std::min(nFullPath, nPrefix));
+            if (cmp < 0 || (cmp == 0 && nFullPath < nPrefix)) {
+                first = i + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        return first;
+    }
+
+private:
+    const char *data;
+    size_t length;
+    const tTableHeader *header;
+    const uint64_t *pathOffsets;
+    const uint32_t *plainOffsets;
+    const uint64_t *sizes;
+    const unsigned char *keys;
+    const uint32_t *locales;
+    const char *heap;
+
+    bool hasColumn(uint64_t offset, uint64_t size) const {
+        return (offset % 8) == 0 && offset <= length && size <= length - offset;
+    }
+
+    bool validate() const {
+        if (memcmp(header->magic, TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0 || header->version != TABLE_VERSION)
+            return false;
+
+        uint64_t rowCount = header->rowCount;
+        if (rowCount > length / sizeof(uint64_t))
+            return false;
+        if (!hasColumn(header->pathOffsets, (rowCount + 1) * sizeof(uint64_t)) ||
+            !hasColumn(header->plainOffsets, rowCount * sizeof(uint32_t)) ||
+            !hasColumn(header->sizes, rowCount * sizeof(uint64_t)) ||
+            !hasColumn(header->keys, rowCount * CONTENT_KEY_SIZE) ||
+            !hasColumn(header->locales, rowCount * sizeof(uint32_t)) ||
+            !hasColumn(header->heap, header->heapSize))
+            return false;
+
+        // Every path must lie in the heap and end with its NUL
+        const uint64_t *offsets = (const uint64_t *) (data + header->pathOffsets);
+        const uint32_t *plain = (const uint32_t *) (data + header->plainOffsets);
+        const char *names = data + header->heap;
+        if (offsets[0] != 0 || offsets[rowCount] > header->heapSize)
+            return false;
+        for (uint64_t i = 0; i < rowCount; ++i) {
+            if (offsets[i + 1] <= offsets[i] || names[offsets[i + 1] - 1] != 0 ||
+                plain[i] >= offsets[i + 1] - offsets[i])
+                return false;
+        }
+        return true;
+    }
+
+    tFileTable(const tFileTable &);
+    tFileTable &operator=(const tFileTable &);
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*****************************************************************************/
+/* trace.h                                   Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* spans written as Chrome trace events, for --trace                         */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_TRACE_H
+#define STORMEXTRACT_TRACE_H
+
+#include "output.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+/* Writes complete ("X") events in the Chrome trace-event format, which
+ * chrome://tracing and Perfetto load as they are.
+ *
+ * Events are streamed to the file through a buffer as each span ends, so a
+ * long run does not keep them in memory.  Any thread may record.
+ */
+class tTracer {
+public:
+    tTracer() : file(NULL), bEnabled(false), nEvents(0) {
+    }
+
+    ~tTracer() {
+        close();
+    }
+
+    bool open(const char *szFileName) {
+        close();
+        file = fopen(szFileName, "w");
+        if (!file)
+            return false;
+        out.reset(new tOutput(file));
+        out->write("{\"traceEvents\":[\n");
+        origin = std::chrono::steady_clock::now();
+        nEvents = 0;
+        bEnabled = true;
+        return true;
+    }
+
+    // @return false if the trace could not be written completely
+    bool close() {
+        if (!file)
+            return true;
+        std::lock_guard<std::mutex> lock(mutex);
+        bEnabled = false;
+        out->write("\n],\"displayTimeUnit\":\"ms\"}\n");
+        out.reset();
+        bool bWritten = !ferror(file);
+        bWritten = (fclose(file) == 0) && bWritten;
+        file = NULL;
+        return bWritten;
+    }
+
+    bool isEnabled() const {
+        return bEnabled;
+    }
+
+    // Microseconds since the trace was opened
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    /* Record a span.
+     *
+     * @param szName    What was done, must be a literal
+     * @param szPath    The file it was done to, may be NULL
+     * @param start     now() when it began
+     * @param end       now() when it ended
+     */
+    void complete(const char *szName, const char *szPath, double start, double end) {
+        char line[160];
+        int n = snprintf(line, sizeof(line), "{\"name\":\"%s\",\"cat\":\"storm-extract\",\"ph\":\"X\","
+                         "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u", szName, start, end - start, threadId());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!bEnabled)
+            return;
+        if (nEvents++)
+            out->write(",\n", 2);
+        out->write(line, size_t(n));
+        if (szPath) {
+            out->write(",\"args\":{\"path\":");
+            out->writeJsonString(szPath, strlen(szPath));
+            out->put('}');
+        }
+        out->put('}');
+    }
+
+    // Small, stable numbers read better in a trace viewer than pthread ids
+    static unsigned int threadId() {
+        static std::atomic<unsigned int> nextId(1);
+        static thread_local unsigned int id = nextId++;
+        return id;
+    }
+
+private:
+    FILE *file;
+    std::unique_ptr<tOutput> out;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point origin;
+    std::atomic<bool> bEnabled;
+    size_t nEvents;
+
+    tTracer(const tTracer &);
+    tTracer &operator=(const tTracer &);
+};
+
+/* Records the scope it lives in as one span.
+ *
+ * With tracing off this is a flag test in the constructor and a NULL test
+ * in the destructor, the clock is never read.
+ */
+class tTraceSpan {
+public:
+    tTraceSpan(tTracer &tracer, const char *szName, const char *szPath = NULL)
+        : tracer(tracer.isEnabled() ? &tracer : NULL), szName(szName), szPath(szPath),
+          start(this->tracer ? tracer.now() : 0) {
+    }
+
+    ~tTraceSpan() {
+        if (tracer)
+            tracer->complete(szName, szPath, start, tracer->now());
+    }
+
+private:
+    tTracer *tracer;
+    const char *szName;
+    const char *szPath;
+    double start;
+
+    tTraceSpan(const tTraceSpan &);
+    tTraceSpan &operator=(const tTraceSpan &);
+};
+
+#endif
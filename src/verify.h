@@ -0,0 +1,216 @@
+/*****************************************************************************/
+/* verify.h                                  Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* comparing an extracted tree with the storage, for --verify                */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_VERIFY_H
+#define STORMEXTRACT_VERIFY_H
+
+#include "../CascLib/src/CascLib.h"
+#include "bufferpool.h"
+#include "md5.h"
+#include "paths.h"
+#include "results.h"
+#include "workers.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum tVerifyStatus {
+    VERIFY_OK,
+    VERIFY_MISSING,                 // No file there
+    VERIFY_TRUNCATED,               // Shorter than in the storage
+    VERIFY_SIZE_DIFFERS,            // Longer than in the storage
+    VERIFY_CONTENT_DIFFERS,         // Same size, other bytes
+    VERIFY_UNREADABLE               // The file or the storage could not be read
+};
+
+struct tVerifyFile {
+    const char *szFullPath;
+    unsigned long long fileSize;
+    const unsigned char *contentKey;    // CONTENT_KEY_SIZE bytes, all zero if unknown
+};
+
+typedef std::function<tVerifyFile (size_t index)> tVerifyAt;
+
+/* Checks files already extracted below a directory against the storage.
+ *
+ * Two passes, both spread over a tWorkerPool: the first only stat()s every
+ * file, so missing and truncated files are known without reading anything;
+ * the second reads the files whose size is right.  A file with a content
+ * key is hashed and compared with it, which never touches the storage.  One
+ * without is compared with the storage itself; CascLib's archive streams
+ * are shared between handles, so those reads take turns.
+ *
+ * Nothing below the directory is ever written.
+ */
+class tVerifier {
+public:
+    static const size_t CHUNK = 256;            // Files per task
+
+    /* @param strRoot       The extracted tree, ending with '/'
+     * @param bLowerCase    Whether it was extracted with -c
+     */
+    tVerifier(HANDLE hStorage, const std::string &strRoot, bool bLowerCase)
+        : hStorage(hStorage), strRoot(strRoot), bLowerCase(bLowerCase) {
+    }
+
+    /* @param count     How many files there are
+     * @param fileAt    File N
+     * @return The status of each file, by index
+     */
+    std::vector<tVerifyStatus> verify(size_t count, const tVerifyAt &fileAt, size_t nThreads) {
+        std::vector<tVerifyStatus> statuses(count, VERIFY_OK);
+        forEachChunk(count, nThreads, [&](size_t begin, size_t end, tDestPath &destPath) {
+            for (size_t i = begin; i < end; ++i)
+                statuses[i] = checkSize(fileAt(i), destPath);
+        });
+        forEachChunk(count, nThreads, [&](size_t begin, size_t end, tDestPath &destPath) {
+            for (size_t i = begin; i < end; ++i) {
+                if (statuses[i] == VERIFY_OK)
+                    statuses[i] = checkContent(fileAt(i), destPath);
+            }
+        });
+        return statuses;
+    }
+
+    static const char *describe(tVerifyStatus status) {
+        switch (status) {
+            case VERIFY_OK:              return "OK";
+            case VERIFY_MISSING:         return "MISSING";
+            case VERIFY_TRUNCATED:       return "TRUNCATED";
+            case VERIFY_SIZE_DIFFERS:    return "SIZE DIFFERS";
+            case VERIFY_CONTENT_DIFFERS: return "DIFFERS";
+            case VERIFY_UNREADABLE:      return "UNREADABLE";
+        }
+        return "";
+    }
+
+private:
+    HANDLE hStorage;
+    std::string strRoot;
+    bool bLowerCase;
+    std::mutex storageMutex;
+
+    void forEachChunk(size_t count, size_t nThreads,
+                      const std::function<void (size_t begin, size_t end, tDestPath &destPath)> &task) {
+        tWorkerPool pool(nThreads);
+        for (size_t begin = 0; begin < count; begin += CHUNK) {
+            size_t end = (count - begin > CHUNK) ? begin + CHUNK : count;
+            pool.submit([this, begin, end, &task]() {
+                tDestPath destPath;
+                destPath.setRoot(strRoot);
+                task(begin, end, destPath);
+            });
+        }
+    }
+
+    tVerifyStatus checkSize(const tVerifyFile &file, tDestPath &destPath) {
+        destPath.build(file.szFullPath, strlen(file.szFullPath), bLowerCase);
+        struct stat info;
+        if (stat(destPath.path().c_str(), &info) != 0)
+            return (errno == ENOENT || errno == ENOTDIR) ? VERIFY_MISSING : VERIFY_UNREADABLE;
+        if (!S_ISREG(info.st_mode))
+            return VERIFY_MISSING;
+        if ((unsigned long long) info.st_size < file.fileSize)
+            return VERIFY_TRUNCATED;
+        if ((unsigned long long) info.st_size > file.fileSize)
+            return VERIFY_SIZE_DIFFERS;
+        return VERIFY_OK;
+    }
+
+    tVerifyStatus checkContent(const tVerifyFile &file, tDestPath &destPath) {
+        destPath.build(file.szFullPath, strlen(file.szFullPath), bLowerCase);
+        int fd = open(destPath.path().c_str(), O_RDONLY);
+        if (fd < 0)
+            return VERIFY_UNREADABLE;
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        tVerifyStatus status = hasContentKey(file.contentKey) ? compareWithKey(fd, file.contentKey)
+                                                              : compareWithStorage(fd, file.szFullPath);
+        close(fd);
+        return status;
+    }
+
+    tVerifyStatus compareWithKey(int fd, const unsigned char *contentKey) {
+        tBuffer buffer = tBufferPool::shared().acquire(0x100000);
+        if (!buffer)
+            return VERIFY_UNREADABLE;
+
+        tMD5 md5;
+        for (;;) {
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return VERIFY_UNREADABLE;
+            if (n == 0)
+                break;
+            md5.update(buffer.data(), size_t(n));
+        }
+
+        unsigned char digest[MD5_DIGEST_SIZE];
+        md5.final(digest);
+        return (memcmp(digest, contentKey, CONTENT_KEY_SIZE) == 0) ? VERIFY_OK : VERIFY_CONTENT_DIFFERS;
+    }
+
+    tVerifyStatus compareWithStorage(int fd, const char *szFullPath) {
+        tBuffer stored = tBufferPool::shared().acquire(0x100000);
+        tBuffer written = tBufferPool::shared().acquire(0x100000);
+        if (!stored || !written)
+            return VERIFY_UNREADABLE;
+
+        std::lock_guard<std::mutex> lock(storageMutex);
+        HANDLE hFile;
+        if (!CascOpenFile(hStorage, szFullPath, CASC_LOCALE_ALL, 0, &hFile))
+            return VERIFY_UNREADABLE;
+
+        tVerifyStatus status = VERIFY_OK;
+        for (;;) {
+            DWORD dwRead = 0;
+            if (!CascReadFile(hFile, stored.data(), DWORD(stored.size()), &dwRead)) {
+                status = VERIFY_UNREADABLE;
+                break;
+            }
+
+            // The sizes already match, a short read of the file is an error
+            size_t nRead = 0;
+            while (nRead < dwRead) {
+                ssize_t n = read(fd, written.data() + nRead, dwRead - nRead);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                nRead += size_t(n);
+            }
+            if (nRead < dwRead) {
+                status = VERIFY_UNREADABLE;
+                break;
+            }
+            if (memcmp(stored.data(), written.data(), dwRead) != 0) {
+                status = VERIFY_CONTENT_DIFFERS;
+                break;
+            }
+            if (dwRead == 0)
+                break;
+        }
+        CascCloseFile(hFile);
+        return status;
+    }
+
+    tVerifier(const tVerifier &);
+    tVerifier &operator=(const tVerifier &);
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*****************************************************************************/
+/* workers.h                                 Copyright 2016 Justin J. Novack */
+/*---------------------------------------------------------------------------*/
+/* a small fixed-size thread pool                                            */
+/*****************************************************************************/
+
+#ifndef STORMEXTRACT_WORKERS_H
+#define STORMEXTRACT_WORKERS_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/* Runs submitted tasks on a fixed number of threads, in submission order.
+ *
+ * Destroying the pool waits for every queued task to finish, so anything the
+ * tasks point to only has to outlive the pool.
+ */
+class tWorkerPool {
+public:
+    explicit tWorkerPool(size_t nThreads) : bStopping(false) {
+        if (nThreads == 0)
+            nThreads = 1;
+        for (size_t i = 0; i < nThreads; ++i)
+            threads.push_back(std::thread(&tWorkerPool::run, this));
+    }
+
+    ~tWorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bStopping = true;
+        }
+        wakeup.notify_all();
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+    }
+
+    void submit(const std::function<void ()> &task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push(task);
+        }
+        wakeup.notify_one();
+    }
+
+    size_t size() const {
+        return threads.size();
+    }
+
+    // One thread per core, or a single one when the count is unknown
+    static size_t defaultThreads() {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::queue<std::function<void ()> > tasks;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool bStopping;
+
+    void run() {
+        for (;;) {
+            std::function<void ()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (tasks.empty() && !bStopping)
+                    wakeup.wait(lock);
+                if (tasks.empty())
+                    return;
+                task = tasks.front();
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    tWorkerPool(const tWorkerPool &);
+    tWorkerPool &operator=(const tWorkerPool &);
+};
+
+#endif